@@ -1,39 +1,66 @@
-#include <ESP8266WiFi.h>
-
 #include "constants.h"
 #include "config.h"
 #include "radio.h"
 #include "lightbar.h"
 #include "mqtt.h"
+#include "capture.h"
+#include "binding.h"
+#include "transition.h"
+#include "logger.h"
+#include "profiler.h"
+#include "network.h"
+#include "learner.h"
+#include "replay.h"
+#include "calibration.h"
+#include "cluster.h"
+#include "device_store.h"
+#include "devices.h"
 
-WiFiClient wifiClient;
-Radio radio(RADIO_PIN_CE, RADIO_PIN_CSN);
-MQTT mqtt(&wifiClient, MQTT_SERVER, MQTT_PORT, MQTT_USER, MQTT_PASSWORD, MQTT_ROOT_TOPIC, HOME_ASSISTANT_DISCOVERY, HOME_ASSISTANT_DISCOVERY_PREFIX);
+// Settings that were added later are optional, so older configurations keep working.
+#ifndef HOME_ASSISTANT_DEVICE_DISCOVERY
+#define HOME_ASSISTANT_DEVICE_DISCOVERY false
+#endif
 
-void setupWifi()
-{
-  Serial.print("[WiFi] Connecting to network \"");
-  Serial.print(WIFI_SSID);
-  Serial.print("\"...");
+#ifndef CLUSTER_MODE
+#define CLUSTER_MODE false
+#endif
 
-  WiFi.hostname(mqtt.getClientId());
-  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+#ifndef CLUSTER_RANK
+#define CLUSTER_RANK 0
+#endif
 
-  uint retries = 0;
-  while (WiFi.status() != WL_CONNECTED)
-  {
-    delay(1000);
-    Serial.print(".");
-    retries++;
-    if (retries > 60)
-      ESP.restart();
-  }
-  Serial.println();
-  Serial.println("[WiFi] connected!");
+#ifdef BINDINGS
+constexpr RemoteBinding REMOTE_BINDINGS[] = BINDINGS;
+constexpr uint8_t NUM_REMOTE_BINDINGS = sizeof(REMOTE_BINDINGS) / sizeof(RemoteBinding);
+#else
+constexpr const RemoteBinding *REMOTE_BINDINGS = nullptr;
+constexpr uint8_t NUM_REMOTE_BINDINGS = 0;
+#endif
 
-  Serial.print("[WiFi] IP address: ");
-  Serial.println(WiFi.localIP());
-}
+#ifdef CALIBRATIONS
+constexpr LightbarCalibration LIGHTBAR_CALIBRATIONS[] = CALIBRATIONS;
+constexpr uint8_t NUM_LIGHTBAR_CALIBRATIONS = sizeof(LIGHTBAR_CALIBRATIONS) / sizeof(LightbarCalibration);
+// Generated by the compiler, see calibration.h.
+constexpr auto CALIBRATION_TABLES = calibration::makeTables(LIGHTBAR_CALIBRATIONS);
+constexpr const CalibrationTable *LIGHTBAR_CALIBRATION_TABLES = CALIBRATION_TABLES.data();
+#else
+constexpr const LightbarCalibration *LIGHTBAR_CALIBRATIONS = nullptr;
+constexpr uint8_t NUM_LIGHTBAR_CALIBRATIONS = 0;
+constexpr const CalibrationTable *LIGHTBAR_CALIBRATION_TABLES = nullptr;
+#endif
+
+Radio radio(RADIO_PIN_CE, RADIO_PIN_CSN);
+Capture capture;
+Bindings bindings;
+Transitions transitions;
+RemoteLearner learner;
+Replay replay;
+Cluster cluster(CLUSTER_RANK);
+
+Network network(WIFI_SSID, WIFI_PASSWORD);
+MQTT mqtt(MQTT_SERVER, MQTT_PORT, MQTT_USER, MQTT_PASSWORD, MQTT_ROOT_TOPIC, HOME_ASSISTANT_DISCOVERY, HOME_ASSISTANT_DISCOVERY_PREFIX, HOME_ASSISTANT_DEVICE_DISCOVERY);
+DeviceStore store;
+Devices devices(&radio, &mqtt, &bindings, &store);
 
 void setup()
 {
@@ -44,32 +71,73 @@ void setup()
   Serial.println("##########################################");
 
   radio.setup();
-
-  setupWifi();
-
-  for (int i = 0; i < sizeof(REMOTES) / sizeof(SerialWithName); i++)
+  radio.setCapture(&capture);
+  mqtt.setCapture(&capture);
+  mqtt.setTransitions(&transitions);
+  mqtt.setRadio(&radio);
+  mqtt.setNetwork(&network);
+  radio.setLearner(&learner);
+  mqtt.setLearner(&learner);
+  radio.setReplay(&replay);
+  mqtt.setReplay(&replay);
+  if (CLUSTER_MODE)
   {
-    Remote *remote = new Remote(&radio, REMOTES[i].serial, REMOTES[i].name);
-    mqtt.addRemote(remote);
+    // Claims compare how well each controller received the event, so the signal strength is needed for every package.
+    radio.setReadRpd(true);
+    mqtt.setCluster(&cluster);
   }
 
-  for (int i = 0; i < sizeof(LIGHTBARS) / sizeof(SerialWithName); i++)
-  {
-    Lightbar *lightbar = new Lightbar(&radio, LIGHTBARS[i].serial, LIGHTBARS[i].name);
-    mqtt.addLightbar(lightbar);
-  }
+  network.connect(mqtt.getClientId());
+
+  // The devices saved at runtime, or the ones from config.h, if there are none or config.h changed.
+  store.begin(LIGHTBARS, sizeof(LIGHTBARS) / sizeof(SerialWithName), REMOTES, sizeof(REMOTES) / sizeof(SerialWithName));
+  devices.setCalibrations(LIGHTBAR_CALIBRATIONS, LIGHTBAR_CALIBRATION_TABLES, NUM_LIGHTBAR_CALIBRATIONS);
+  devices.setBindings(REMOTE_BINDINGS, NUM_REMOTE_BINDINGS);
+  devices.setup();
+  mqtt.setDevices(&devices);
 
   mqtt.setup();
+
+  // From now on, log messages are written to the serial port in the background.
+  logger.setSynchronous(false);
 }
 
 void loop()
 {
+  profiler.beginLoop();
+
   if (!WiFi.isConnected())
   {
-    Serial.println("[WiFi] connection lost!");
-    setupWifi();
+    LOG_WARNING("[WiFi] connection lost!");
+    network.connect(mqtt.getClientId());
+  }
+
+  // The radio and everything else only talk through the radio's queues, so either side can be moved to its own
+  // task, where the platform allows it.
+  {
+    PROFILE_SCOPE("radio.loop");
+    radio.loop();
+  }
+  {
+    PROFILE_SCOPE("radio.events");
+    radio.processEvents();
+  }
+  {
+    PROFILE_SCOPE("mqtt.loop");
+    mqtt.loop();
+  }
+  {
+    PROFILE_SCOPE("replay.loop");
+    replay.loop();
+  }
+  {
+    PROFILE_SCOPE("transitions.loop");
+    transitions.loop();
+  }
+  {
+    PROFILE_SCOPE("logger.loop");
+    logger.loop();
   }
 
-  mqtt.loop();
-  radio.loop();
+  profiler.endLoop();
 }
\ No newline at end of file
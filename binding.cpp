@@ -0,0 +1,87 @@
+#include "binding.h"
+#include "logger.h"
+
+Bindings::Bindings()
+{
+    this->remoteCommandHandler = std::bind(&Bindings::onRemoteCommand, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
+}
+
+Bindings::~Bindings()
+{
+}
+
+bool Bindings::bind(Remote *remote, Lightbar *lightbar)
+{
+    bool remoteKnown = false;
+    for (int i = 0; i < this->numBindings; i++)
+    {
+        if (this->bindings[i].remote != remote)
+            continue;
+        if (this->bindings[i].lightbar == lightbar)
+            return true;
+        remoteKnown = true;
+    }
+
+    if (this->numBindings >= constants::MAX_BINDINGS)
+    {
+        LOG_ERROR("[Bindings] Could not add binding, because too many bindings are saved!");
+        LOG_ERROR("[Bindings] Please check if you actually want to save more than %u bindings.", constants::MAX_BINDINGS);
+        LOG_ERROR("[Bindings] If you do, increase MAX_BINDINGS in constants.h and recompile.");
+        return false;
+    }
+
+    // Only listen once per remote, no matter how many light bars it controls.
+    if (!remoteKnown && !remote->registerCommandListener(this->remoteCommandHandler, this))
+        return false;
+
+    this->bindings[this->numBindings].remote = remote;
+    this->bindings[this->numBindings].lightbar = lightbar;
+    this->numBindings++;
+    LOG_INFO("[Bindings] Remote %s bound to light bar %s", remote->getSerialString().c_str(), lightbar->getSerialString().c_str());
+    return true;
+}
+
+bool Bindings::unbind(Remote *remote, Lightbar *lightbar)
+{
+    for (int i = 0; i < this->numBindings; i++)
+    {
+        if (this->bindings[i].remote == remote && this->bindings[i].lightbar == lightbar)
+        {
+            for (int j = i; j < this->numBindings - 1; j++)
+            {
+                this->bindings[j] = this->bindings[j + 1];
+            }
+            this->numBindings--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Bindings::removeLightbar(Lightbar *lightbar)
+{
+    for (int i = this->numBindings - 1; i >= 0; i--)
+    {
+        if (this->bindings[i].lightbar == lightbar)
+            this->unbind(this->bindings[i].remote, lightbar);
+    }
+}
+
+void Bindings::removeRemote(Remote *remote)
+{
+    for (int i = this->numBindings - 1; i >= 0; i--)
+    {
+        if (this->bindings[i].remote == remote)
+            this->unbind(remote, this->bindings[i].lightbar);
+    }
+    remote->unregisterCommandListeners(this);
+}
+
+void Bindings::onRemoteCommand(Remote *remote, byte command, byte options)
+{
+    for (int i = 0; i < this->numBindings; i++)
+    {
+        if (this->bindings[i].remote == remote)
+            this->bindings[i].lightbar->handleRemoteCommand(command, options);
+    }
+}
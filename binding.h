@@ -0,0 +1,35 @@
+#ifndef BINDING_H
+#define BINDING_H
+
+#include "constants.h"
+#include "remote.h"
+#include "lightbar.h"
+
+class Remote;
+class Lightbar;
+
+struct Binding
+{
+    Remote *remote;
+    Lightbar *lightbar;
+};
+
+class Bindings
+{
+public:
+    Bindings();
+    ~Bindings();
+    bool bind(Remote *remote, Lightbar *lightbar);
+    bool unbind(Remote *remote, Lightbar *lightbar);
+    void removeLightbar(Lightbar *lightbar);
+    void removeRemote(Remote *remote);
+    void onRemoteCommand(Remote *remote, byte command, byte options);
+
+private:
+    Binding bindings[constants::MAX_BINDINGS];
+    uint8_t numBindings = 0;
+
+    std::function<void(Remote *, byte, byte)> remoteCommandHandler;
+};
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <array>
+#include <utility>
+
+#include "constants.h"
+
+namespace calibration
+{
+    // Minimal constexpr versions of log(), exp() and pow(), so the tables can be generated by the compiler.
+    constexpr double log(double x)
+    {
+        // Reduce to x = m * 2^k with m in [0.5, 1), then use the series of 2 * atanh((m - 1) / (m + 1)).
+        int k = 0;
+        while (x >= 1.0)
+        {
+            x /= 2.0;
+            k++;
+        }
+        while (x < 0.5)
+        {
+            x *= 2.0;
+            k--;
+        }
+        double z = (x - 1.0) / (x + 1.0);
+        double term = z;
+        double sum = 0.0;
+        for (int n = 1; n < 40; n += 2)
+        {
+            sum += term / n;
+            term *= z * z;
+        }
+        return 2.0 * sum + k * 0.6931471805599453;
+    }
+
+    constexpr double exp(double x)
+    {
+        // Halve the argument until the series converges quickly, then square the result back up.
+        int halvings = 0;
+        while (x > 0.5 || x < -0.5)
+        {
+            x /= 2.0;
+            halvings++;
+        }
+        double term = 1.0;
+        double sum = 1.0;
+        for (int n = 1; n < 20; n++)
+        {
+            term *= x / n;
+            sum += term;
+        }
+        for (int i = 0; i < halvings; i++)
+        {
+            sum *= sum;
+        }
+        return sum;
+    }
+
+    constexpr double pow(double base, double exponent)
+    {
+        return base <= 0.0 ? 0.0 : exp(exponent * log(base));
+    }
+}
+
+/*
+ * Converts between Home Assistant's values and the steps of a light bar. Everything is calculated by the
+ * compiler, at runtime every conversion is a single table lookup.
+ *
+ * Home Assistant's brightness of 0 – 255 is mapped onto the 16 steps as step = round(15 * (brightness / 255)^gamma).
+ * A gamma of 1 is linear, larger values spend more of the slider on the lower steps. The step is reported back as
+ * the brightness closest to the inverse of that curve, that still maps to the same step.
+ * The color temperature is mapped linearly from the calibrated range of mireds, step 0 being the warmest one.
+ */
+class CalibrationTable
+{
+public:
+    static constexpr uint8_t NUM_STEPS = 16;
+
+    constexpr CalibrationTable(const Calibration &calibration)
+        : minMireds(calibration.minMireds),
+          maxMireds(calibration.maxMireds > calibration.minMireds + constants::CALIBRATION_MIRED_SPAN - 1
+                        ? calibration.minMireds + constants::CALIBRATION_MIRED_SPAN - 1
+                        : (calibration.maxMireds > calibration.minMireds ? calibration.maxMireds : calibration.minMireds + 1)),
+          brightnessSteps{}, brightnessValues{}, miredSteps{}, miredValues{}
+    {
+        const uint8_t maxStep = NUM_STEPS - 1;
+
+        for (int brightness = 0; brightness < 256; brightness++)
+        {
+            double level = calibration::pow(brightness / 255.0, calibration.gamma);
+            this->brightnessSteps[brightness] = (uint8_t)(level * maxStep + 0.5);
+        }
+        for (int step = 0; step < NUM_STEPS; step++)
+        {
+            int ideal = (int)(255.0 * calibration::pow((double)step / maxStep, 1.0 / calibration.gamma) + 0.5);
+            int low = 255;
+            int high = 0;
+            for (int brightness = 0; brightness < 256; brightness++)
+            {
+                if (this->brightnessSteps[brightness] != step)
+                    continue;
+                low = brightness < low ? brightness : low;
+                high = brightness > high ? brightness : high;
+            }
+            // Steps no brightness maps to are left at their ideal value.
+            if (low <= high)
+                ideal = ideal < low ? low : (ideal > high ? high : ideal);
+            this->brightnessValues[step] = (uint8_t)ideal;
+        }
+
+        const uint16_t range = this->maxMireds - this->minMireds;
+        for (int offset = 0; offset < constants::CALIBRATION_MIRED_SPAN; offset++)
+        {
+            int clamped = offset < range ? offset : range;
+            this->miredSteps[offset] = (uint8_t)(maxStep - (clamped * maxStep + range / 2) / range);
+        }
+        for (int step = 0; step < NUM_STEPS; step++)
+        {
+            this->miredValues[step] = this->maxMireds - (step * range + maxStep / 2) / maxStep;
+        }
+    }
+
+    uint8_t brightnessToStep(uint8_t brightness) const
+    {
+        return this->brightnessSteps[brightness];
+    }
+
+    uint8_t stepToBrightness(uint8_t step) const
+    {
+        return this->brightnessValues[step < NUM_STEPS ? step : NUM_STEPS - 1];
+    }
+
+    uint8_t miredsToStep(uint mireds) const
+    {
+        mireds = mireds < this->minMireds ? this->minMireds : mireds;
+        mireds = mireds > this->maxMireds ? this->maxMireds : mireds;
+        return this->miredSteps[mireds - this->minMireds];
+    }
+
+    uint16_t stepToMireds(uint8_t step) const
+    {
+        return this->miredValues[step < NUM_STEPS ? step : NUM_STEPS - 1];
+    }
+
+    uint16_t getMinMireds() const
+    {
+        return this->minMireds;
+    }
+
+    uint16_t getMaxMireds() const
+    {
+        return this->maxMireds;
+    }
+
+private:
+    uint16_t minMireds;
+    uint16_t maxMireds;
+    uint8_t brightnessSteps[256];
+    uint8_t brightnessValues[NUM_STEPS];
+    uint8_t miredSteps[constants::CALIBRATION_MIRED_SPAN];
+    uint16_t miredValues[NUM_STEPS];
+};
+
+namespace calibration
+{
+    // Used for all light bars without an entry in CALIBRATIONS. This matches the range of the original light bar.
+    // Inline, so there is a single copy of the table, no matter how many files take its address.
+    inline constexpr Calibration DEFAULT = {153, 370, 1.0f};
+    inline constexpr CalibrationTable DEFAULT_TABLE = CalibrationTable(DEFAULT);
+
+    template <size_t N, size_t... I>
+    constexpr std::array<CalibrationTable, N> makeTables(const LightbarCalibration (&calibrations)[N], std::index_sequence<I...>)
+    {
+        return {{CalibrationTable(calibrations[I].calibration)...}};
+    }
+
+    // Generates the tables for all entries of a calibration array at compile time.
+    template <size_t N>
+    constexpr std::array<CalibrationTable, N> makeTables(const LightbarCalibration (&calibrations)[N])
+    {
+        return makeTables(calibrations, std::make_index_sequence<N>{});
+    }
+}
+
+#endif
@@ -0,0 +1,101 @@
+#include "capture.h"
+#include "logger.h"
+
+Capture::Capture()
+{
+    this->clearBatch();
+}
+
+Capture::~Capture()
+{
+}
+
+void Capture::setEnabled(bool enabled)
+{
+    if (this->enabled == enabled)
+        return;
+    this->enabled = enabled;
+    this->dropped = 0;
+    this->clearBatch();
+    LOG_INFO(enabled ? "[Capture] enabled!" : "[Capture] disabled!");
+}
+
+bool Capture::isEnabled()
+{
+    return this->enabled;
+}
+
+void Capture::record(unsigned long timestamp, Result result, bool rpd, const byte *raw_data, const byte *data)
+{
+    if (!this->enabled)
+        return;
+
+    // The batch is only cleared once it was published. Count everything that does not fit in the
+    // meantime, so the receiving side knows about the gap.
+    if (this->num_records >= constants::CAPTURE_BATCH_RECORDS)
+    {
+        if (this->dropped < 0xFFFF)
+            this->dropped++;
+        return;
+    }
+
+    if (this->num_records == 0)
+        this->first_record_millis = millis();
+
+    byte *record = this->batch + HEADER_LENGTH + this->num_records * RECORD_LENGTH;
+    record[0] = timestamp & 0xFF;
+    record[1] = (timestamp >> 8) & 0xFF;
+    record[2] = (timestamp >> 16) & 0xFF;
+    record[3] = (timestamp >> 24) & 0xFF;
+    record[4] = result;
+    record[5] = rpd ? FLAG_RPD : 0x00;
+    memcpy(record + 6, raw_data, RAW_LENGTH);
+    memcpy(record + 6 + RAW_LENGTH, data, DECODED_LENGTH);
+    this->num_records++;
+}
+
+bool Capture::isBatchReady()
+{
+    if (this->num_records == 0)
+        return false;
+    if (this->num_records >= constants::CAPTURE_BATCH_RECORDS)
+        return true;
+    return millis() - this->first_record_millis >= constants::CAPTURE_FLUSH_INTERVAL_MS;
+}
+
+const byte *Capture::getBatch()
+{
+    this->writeHeader();
+    return this->batch;
+}
+
+uint16_t Capture::getBatchLength()
+{
+    return HEADER_LENGTH + this->num_records * RECORD_LENGTH;
+}
+
+void Capture::clearBatch()
+{
+    if (this->num_records > 0)
+    {
+        this->batch_sequence++;
+        this->dropped = 0;
+    }
+    this->num_records = 0;
+}
+
+void Capture::writeHeader()
+{
+    this->batch[0] = 'L';
+    this->batch[1] = '2';
+    this->batch[2] = 'M';
+    this->batch[3] = 'C';
+    this->batch[4] = FORMAT_VERSION;
+    this->batch[5] = RECORD_LENGTH;
+    this->batch[6] = this->num_records & 0xFF;
+    this->batch[7] = (this->num_records >> 8) & 0xFF;
+    this->batch[8] = this->batch_sequence & 0xFF;
+    this->batch[9] = (this->batch_sequence >> 8) & 0xFF;
+    this->batch[10] = this->dropped & 0xFF;
+    this->batch[11] = (this->dropped >> 8) & 0xFF;
+}
@@ -0,0 +1,68 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "constants.h"
+
+/*
+ * Batch structure (all multi-byte values little endian):
+ *  0 –  3: Magic ("L2MC")
+ *  4 –  4: Format version
+ *  5 –  5: Record length in bytes
+ *  6 –  7: Number of records in this batch
+ *  8 –  9: Batch sequence number
+ * 10 – 11: Records dropped since the previous batch
+ * 12 – ..: Records
+ *
+ * Record structure:
+ *  0 –  3: Timestamp (micros())
+ *  4 –  4: Result (see Capture::Result)
+ *  5 –  5: Flags (bit 0: received power detector (RPD) was set)
+ *  6 – 23: Raw data as read from the nRF24
+ * 24 – 40: Decoded package
+ */
+
+class Capture
+{
+public:
+    enum Result
+    {
+        ACCEPTED = 0x00,
+        WRONG_PREAMBLE = 0x01,
+        WRONG_CHECKSUM = 0x02,
+        UNKNOWN_SERIAL = 0x03,
+        DUPLICATE = 0x04
+    };
+
+    static const uint8_t NUM_RESULTS = 5;
+
+    static const uint8_t FLAG_RPD = 0x01;
+
+    static const uint8_t FORMAT_VERSION = 1;
+    static const uint8_t HEADER_LENGTH = 12;
+    static const uint8_t RAW_LENGTH = 18;
+    static const uint8_t DECODED_LENGTH = 17;
+    static const uint8_t RECORD_LENGTH = 4 + 1 + 1 + RAW_LENGTH + DECODED_LENGTH;
+
+    Capture();
+    ~Capture();
+
+    void setEnabled(bool enabled);
+    bool isEnabled();
+    void record(unsigned long timestamp, Result result, bool rpd, const byte *raw_data, const byte *data);
+    bool isBatchReady();
+    const byte *getBatch();
+    uint16_t getBatchLength();
+    void clearBatch();
+
+private:
+    bool enabled = false;
+    byte batch[HEADER_LENGTH + constants::CAPTURE_BATCH_RECORDS * RECORD_LENGTH];
+    uint16_t num_records = 0;
+    uint16_t batch_sequence = 0;
+    uint16_t dropped = 0;
+    unsigned long first_record_millis = 0;
+
+    void writeHeader();
+};
+
+#endif
@@ -0,0 +1,185 @@
+#include "cluster.h"
+#include "logger.h"
+
+Cluster::Cluster(uint8_t rank)
+{
+    this->rank = rank;
+}
+
+Cluster::~Cluster()
+{
+}
+
+void Cluster::setClientId(const String &clientId)
+{
+    this->clientId = clientId;
+}
+
+uint8_t Cluster::getRank()
+{
+    return this->rank;
+}
+
+Cluster::ClaimResult Cluster::claim(const ClusterClaim &claim, const ClusterEvent &event)
+{
+    // Other controllers might have heard the event earlier, check the claims they already sent.
+    unsigned long now = millis();
+    for (int i = 0; i < this->numForeign; i++)
+    {
+        const ForeignClaim *foreign = &this->foreign[(this->foreignHead + i) % constants::CLUSTER_MAX_FOREIGN_CLAIMS];
+        if (now - foreign->received > constants::CLUSTER_CLAIM_WINDOW_MS)
+            continue;
+        if (!Cluster::overlaps(foreign->claim, claim))
+            continue;
+        if (this->beats(foreign->claim, foreign->clientId, claim))
+        {
+            LOG_DEBUG("[Cluster] Event %u of remote 0x%06X is already claimed by %s.", claim.sequence, claim.serial, foreign->clientId);
+            this->stats.lost++;
+            return ClaimResult::LOST;
+        }
+    }
+
+    if (this->numPending >= constants::CLUSTER_MAX_CLAIMS)
+    {
+        this->stats.overflows++;
+        return ClaimResult::UNCLAIMED;
+    }
+
+    this->pending[this->numPending] = {claim, event, now + constants::CLUSTER_CLAIM_WINDOW_MS, false};
+    this->numPending++;
+    this->stats.claimed++;
+    return ClaimResult::PENDING;
+}
+
+void Cluster::handleClaim(const char *clientId, const ClusterClaim &claim)
+{
+    // Claims are sent to all controllers, including the one that sent it.
+    if (!strcmp(clientId, this->clientId.c_str()))
+        return;
+    this->stats.received++;
+
+    for (int i = 0; i < this->numPending; i++)
+    {
+        PendingClaim *pending = &this->pending[i];
+        if (pending->lost || !Cluster::overlaps(pending->claim, claim))
+            continue;
+        if (!this->beats(claim, clientId, pending->claim))
+            continue;
+        LOG_DEBUG("[Cluster] Lost event %u of remote 0x%06X to %s.", claim.sequence, claim.serial, clientId);
+        pending->lost = true;
+        this->stats.lost++;
+    }
+
+    // Keep the latest claims, overwrite the oldest ones otherwise.
+    ForeignClaim *foreign = &this->foreign[(this->foreignHead + this->numForeign) % constants::CLUSTER_MAX_FOREIGN_CLAIMS];
+    if (this->numForeign < constants::CLUSTER_MAX_FOREIGN_CLAIMS)
+        this->numForeign++;
+    else
+        this->foreignHead = (this->foreignHead + 1) % constants::CLUSTER_MAX_FOREIGN_CLAIMS;
+    foreign->claim = claim;
+    strncpy(foreign->clientId, clientId, sizeof(foreign->clientId) - 1);
+    foreign->clientId[sizeof(foreign->clientId) - 1] = '\0';
+    foreign->received = millis();
+}
+
+bool Cluster::popWon(ClusterEvent *event)
+{
+    unsigned long now = millis();
+    for (int i = 0; i < this->numPending; i++)
+    {
+        PendingClaim *pending = &this->pending[i];
+        if ((long)(now - pending->deadline) < 0)
+            continue;
+
+        bool won = !pending->lost;
+        if (won)
+        {
+            *event = pending->event;
+            this->stats.won++;
+        }
+        this->removePending(i);
+        if (won)
+            return true;
+        i--;
+    }
+    return false;
+}
+
+void Cluster::cancel(Remote *remote)
+{
+    for (int i = 0; i < this->numPending; i++)
+    {
+        if (this->pending[i].event.remote != remote)
+            continue;
+        this->removePending(i);
+        i--;
+    }
+}
+
+void Cluster::withdraw()
+{
+    // Takes back the claim that was added last, because it could not be announced. The event is published unclaimed.
+    if (this->numPending == 0)
+        return;
+    this->removePending(this->numPending - 1);
+    this->stats.claimed--;
+    this->stats.overflows++;
+}
+
+const ClusterStats *Cluster::getStats()
+{
+    return &this->stats;
+}
+
+String Cluster::formatClaim(const ClusterClaim &claim)
+{
+    return String(claim.serial, HEX) + "," + String(claim.sequence) + "," + String(claim.rpd ? 1 : 0) + "," + String(claim.rank) +
+           "," + String(claim.lastSequence) + "," + String(claim.gesture ? 1 : 0);
+}
+
+bool Cluster::parseClaim(const char *payload, ClusterClaim *claim)
+{
+    unsigned int serial, sequence, rpd, rank, lastSequence, gesture;
+    int fields = sscanf(payload, "%x,%u,%u,%u,%u,%u", &serial, &sequence, &rpd, &rank, &lastSequence, &gesture);
+    // Claims of older versions only name a single sequence number.
+    if (fields == 4)
+    {
+        lastSequence = sequence;
+        gesture = 0;
+    }
+    else if (fields != 6)
+        return false;
+    if (sequence > 0xFF || rank > 0xFF || lastSequence > 0xFF)
+        return false;
+    *claim = {(uint32_t)serial, (uint8_t)sequence, rpd != 0, (uint8_t)rank, (uint8_t)lastSequence, gesture != 0};
+    return true;
+}
+
+bool Cluster::overlaps(const ClusterClaim &claim, const ClusterClaim &other)
+{
+    if (claim.serial != other.serial || claim.gesture != other.gesture)
+        return false;
+    // Either range starts within the other one, taking the wrap around of the 8 bit counter into account.
+    uint8_t length = claim.lastSequence - claim.sequence;
+    uint8_t otherLength = other.lastSequence - other.sequence;
+    return (uint8_t)(other.sequence - claim.sequence) <= length || (uint8_t)(claim.sequence - other.sequence) <= otherLength;
+}
+
+bool Cluster::beats(const ClusterClaim &claim, const char *clientId, const ClusterClaim &other)
+{
+    // The own claim is always the other one.
+    if (claim.rank != other.rank)
+        return claim.rank < other.rank;
+    if (claim.rpd != other.rpd)
+        return claim.rpd;
+    return strcmp(clientId, this->clientId.c_str()) < 0;
+}
+
+void Cluster::removePending(uint8_t index)
+{
+    for (int i = index; i < this->numPending - 1; i++)
+    {
+        this->pending[i] = this->pending[i + 1];
+    }
+    this->numPending--;
+}
@@ -0,0 +1,110 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include "constants.h"
+#include "remote.h"
+#include "gesture.h"
+
+class Remote;
+
+// An event of a remote that is only published by the controller that wins its claim.
+struct ClusterEvent
+{
+    Remote *remote;
+    // Either a whole gesture or a single action.
+    bool isGesture;
+    Gesture gesture;
+    byte command;
+    byte options;
+};
+
+// Identifies an event by its remote and the sequence numbers it covers, together with how well the controller received
+// it. Actions cover a single sequence number, gestures all of their turns. Claims of the same kind whose sequence
+// numbers overlap are for the same event, even if a controller missed the first turn of a gesture or split it
+// differently.
+struct ClusterClaim
+{
+    uint32_t serial;
+    uint8_t sequence;
+    bool rpd;
+    uint8_t rank;
+    uint8_t lastSequence;
+    bool gesture;
+};
+
+struct PendingClaim
+{
+    ClusterClaim claim;
+    ClusterEvent event;
+    unsigned long deadline;
+    bool lost;
+};
+
+struct ForeignClaim
+{
+    ClusterClaim claim;
+    char clientId[constants::CLUSTER_CLIENT_ID_LENGTH];
+    unsigned long received;
+};
+
+struct ClusterStats
+{
+    uint32_t claimed;
+    uint32_t received;
+    uint32_t won;
+    uint32_t lost;
+    uint32_t overflows;
+};
+
+/*
+ * Makes sure only one of several controllers that hear the same remote publishes its events. Every controller
+ * claims an event it received and waits CLUSTER_CLAIM_WINDOW_MS for the claims of the others. The claim with the
+ * lowest rank wins, then the one that was received with a strong signal, then the one of the lowest client ID.
+ * Since every controller applies the same rules to the same claims, exactly one of them publishes the event.
+ */
+class Cluster
+{
+public:
+    enum ClaimResult
+    {
+        // The claim has to be announced, the event is returned by popWon() if it is not beaten until then.
+        PENDING,
+        // Another controller already claimed the event with a better claim.
+        LOST,
+        // There is no room for the claim, the event has to be published right away.
+        UNCLAIMED
+    };
+
+    Cluster(uint8_t rank);
+    ~Cluster();
+
+    void setClientId(const String &clientId);
+    uint8_t getRank();
+    ClaimResult claim(const ClusterClaim &claim, const ClusterEvent &event);
+    void handleClaim(const char *clientId, const ClusterClaim &claim);
+    bool popWon(ClusterEvent *event);
+    void cancel(Remote *remote);
+    void withdraw();
+    const ClusterStats *getStats();
+
+    static String formatClaim(const ClusterClaim &claim);
+    static bool parseClaim(const char *payload, ClusterClaim *claim);
+
+private:
+    uint8_t rank;
+    String clientId;
+    ClusterStats stats = {};
+
+    PendingClaim pending[constants::CLUSTER_MAX_CLAIMS];
+    uint8_t numPending = 0;
+
+    ForeignClaim foreign[constants::CLUSTER_MAX_FOREIGN_CLAIMS];
+    uint8_t foreignHead = 0;
+    uint8_t numForeign = 0;
+
+    static bool overlaps(const ClusterClaim &claim, const ClusterClaim &other);
+    bool beats(const ClusterClaim &claim, const char *clientId, const ClusterClaim &other);
+    void removePending(uint8_t index);
+};
+
+#endif
@@ -9,6 +9,8 @@
 
 /* -- Light Bars ---------------------------------------------------------------------------------------------- */
 // All light bars that should be controlled by this controller. Each light bar must have a unique serial.
+// Light bars and remotes can also be added and removed over MQTT while the controller is running. These changes are
+// kept until this list or REMOTES is changed and flashed again.
 // Each entry consists of the serial and the name of the light bar. By default, up to 10 light bars can be added.
 //
 // If the serial is set to the same value as one remote's, the original remote will still control the light bar
@@ -31,6 +33,23 @@ constexpr SerialWithName REMOTES[] = {
     {0x123456, "Remote 1"},
 };
 
+/* -- Calibration ------------------------------------------------------------------------------------------- */
+// Optional calibration per light bar. Each entry consists of the serial of the light bar, the coolest and the
+// warmest color temperature in mireds, and the gamma of the brightness curve. A gamma of 1.0 maps Home Assistant's
+// brightness linearly onto the 16 steps of the light bar, larger values like 2.2 give the lower steps more room on
+// the slider. The range of mireds may span at most 255 mireds. Light bars without an entry use {153, 370, 1.0}.
+// Leave this commented out if all light bars use the defaults.
+// #define CALIBRATIONS {{0xABCDEF, {153, 370, 1.0f}}}
+
+/* -- Bindings ---------------------------------------------------------------------------------------------- */
+// Remotes that should control light bars directly. Commands of a bound remote are forwarded to the light bar by
+// the controller itself, without the detour via MQTT and Home Assistant. This also works if the network is down.
+// The remote's events are still sent to MQTT.
+// Each entry consists of the serial of the remote and the serial of the light bar. Both must be added above. To
+// control multiple light bars with one remote, add one entry for each light bar. Leave this commented out if no
+// remote should be bound.
+// #define BINDINGS {{0x123456, 0xABCDEF}}
+
 /* -- WiFi ---------------------------------------------------------------------------------------------------- */
 // The SSID of the WiFi network to connect to.
 #define WIFI_SSID "<Your WiFi>"
@@ -60,6 +79,15 @@ constexpr SerialWithName REMOTES[] = {
 // have multiple controllers in your network without any conflicts.
 #define MQTT_ROOT_TOPIC "lightbar2mqtt"
 
+// Whether this controller shares a room with other controllers that hear the same remotes. In cluster mode, the
+// controllers agree via the MQTT broker on which of them publishes an event of a remote, so automations only fire
+// once. All controllers of a cluster must use the same MQTT_ROOT_TOPIC. Events are published a little later.
+#define CLUSTER_MODE false
+
+// Controllers with a lower rank are preferred for publishing events. Among controllers with the same rank, the one
+// with the better reception wins. Give the same rank to all controllers, unless one of them should be preferred.
+#define CLUSTER_RANK 0
+
 /* -- Home Assistant Device Discovery ------------------------------------------------------------------------- */
 // Whether to send Home Assistant discovery messages.
 #define HOME_ASSISTANT_DISCOVERY true
@@ -68,6 +96,11 @@ constexpr SerialWithName REMOTES[] = {
 // This must match the prefix used in your Home Assistant configuration. The default is "homeassistant".
 #define HOME_ASSISTANT_DISCOVERY_PREFIX "homeassistant"
 
+// Whether to announce every light bar and remote with a single discovery message for the whole device, instead of
+// one message per entity. This needs Home Assistant 2024.11 or newer. If you switch an existing installation, delete
+// the old retained messages below the discovery prefix from your broker once, so the old entities don't stick around.
+#define HOME_ASSISTANT_DEVICE_DISCOVERY false
+
 // The name of the device to use in Home Assistant.
 // This is the name that will be displayed in the Home Assistant UI. Of course, you can change this in the UI
 // later on. But if you want to have a specific name from the beginning or make it easier to identify the device,
@@ -19,8 +19,168 @@ namespace constants
     // This should always >= MAX_REMOTES + MAX_LIGHTBARS.
     const uint8_t MAX_SERIALS = 32;
 
+    // The maximum length of the name of a light bar or remote in the device store, including the terminating null
+    // character. Longer names are cut off.
+    const uint8_t DEVICE_NAME_LENGTH = 32;
+
+    // The file on LittleFS the light bars and remotes are saved in.
+    const char DEVICE_STORE_PATH[] = "/devices.bin";
+
+    // The maximum number of unknown serials remembered while learning new remotes.
+    const uint8_t LEARN_MAX_CANDIDATES = 8;
+
+    // The minimum time between two publications of the learned candidates.
+    const unsigned long LEARN_PUBLISH_INTERVAL_MS = 1000;
+
+    // The number of slots for frames waiting to be replayed. Needs to be a power of two.
+    const uint8_t REPLAY_QUEUE_SIZE = 64;
+
+    // The maximum number of replayed frames handled per loop iteration.
+    const uint8_t REPLAY_MAX_FRAMES_PER_LOOP = 8;
+
+    // The maximum number of serials a single replay keeps sequence numbers for.
+    const uint8_t REPLAY_MAX_SERIALS = 8;
+
+    // How long to wait for the last events after all frames were replayed, before reporting the results.
+    const unsigned long REPLAY_SETTLE_MS = 500;
+
+    // The widest range of mireds a light bar calibration can span. Wider ranges are cut off at the warm end.
+    const uint16_t CALIBRATION_MIRED_SPAN = 256;
+
+    // The maximum number of commands waiting to be sent by the radio.
+    const uint8_t TX_QUEUE_SIZE = 32;
+
+    // How often every command is sent. Light bars miss single packages now and then, the repeats make up for it.
+    const uint8_t TX_REPEAT_COUNT = 20;
+
+    // The time in microseconds between the repeats of a command. The burst runs in the background of the main loop,
+    // so this only affects how long the radio can't receive. With 0, the repeats are sent back to back from the
+    // nRF24's FIFO, but not all light bars might catch that.
+    const unsigned long TX_PACKET_SPACING_US = 10000;
+
+    // The time in microseconds the FIFO may take to run empty after the last repeat, before the burst is aborted.
+    const unsigned long TX_DRAIN_TIMEOUT_US = 10000;
+
+    // The number of slots in the queues between the radio and the rest of the controller. One slot always stays
+    // empty. Both need to be a power of two. At boot, every device is added before the radio handles any request.
+    const uint8_t RADIO_EVENT_QUEUE_SIZE = 16;
+    const uint8_t RADIO_REQUEST_QUEUE_SIZE = 32;
+    static_assert(RADIO_REQUEST_QUEUE_SIZE >= MAX_LIGHTBARS + MAX_REMOTES + 1, "All devices must fit into the request queue at boot");
+
     // The maximum number of command listeners that can be registered for a remote.
     const uint8_t MAX_COMMAND_LISTENERS = 10;
+
+    // The maximum number of commands per light bar the radio has not reported as sent or dropped yet. If more are
+    // waiting, the oldest one is assumed to be sent.
+    const uint8_t LIGHTBAR_MAX_PENDING_COMMANDS = 16;
+
+    // The maximum number of bindings between remotes and light bars.
+    const uint8_t MAX_BINDINGS = 20;
+
+    // The time in milliseconds an action is kept in a remote's state topic before it is cleared again.
+    const unsigned long ACTION_CLEAR_DELAY_MS = 200;
+
+    // The maximum number of MQTT messages that can wait to be sent. If the broker can't keep up, new messages are
+    // dropped once the queue is full.
+    const uint8_t MQTT_OUTBOUND_QUEUE_SIZE = 32;
+
+    // The maximum number of payload bytes of all MQTT messages waiting to be sent.
+    const size_t MQTT_OUTBOUND_QUEUE_BYTES = 8192;
+
+    // The maximum number of QoS 1 messages that have been sent, but not yet acknowledged by the broker.
+    const uint8_t MQTT_IN_FLIGHT_WINDOW = 4;
+
+    // The number of free slots in the outbound queue that are kept for actions and state updates while discovery
+    // messages are sent.
+    const uint8_t MQTT_DISCOVERY_QUEUE_RESERVE = 12;
+
+    // The maximum number of received MQTT messages that can wait to be handled.
+    const uint8_t MQTT_INBOUND_QUEUE_SIZE = 8;
+
+    // The maximum number of received binary commands that can wait to be handled. Commands for the same light bar
+    // are merged while waiting.
+    const uint8_t MQTT_RAW_COMMAND_QUEUE_SIZE = 16;
+
+    // The time in milliseconds between two attempts to connect to the MQTT broker.
+    const unsigned long MQTT_RECONNECT_INTERVAL_MS = 1000;
+
+    // The time in milliseconds after which a connection attempt to the MQTT broker is given up.
+    const unsigned long MQTT_CONNECT_TIMEOUT_MS = 10000;
+
+    // The time in milliseconds a light bar's state has to stay unchanged before it is sent via MQTT. This way, a
+    // burst of changes results in a single update.
+    const unsigned long STATE_PUBLISH_DEBOUNCE_MS = 250;
+
+    // The maximum time in milliseconds a changed light bar state is held back while it keeps changing.
+    const unsigned long STATE_PUBLISH_MAX_DELAY_MS = 1000;
+
+    // The interval in milliseconds in which statistics are sent via MQTT.
+    const unsigned long STATS_INTERVAL_MS = 60000;
+
+    // The minimum time in milliseconds between two steps of a transition. Every step is a single command to the
+    // light bar and waits until the previous one was sent, which takes TX_REPEAT_COUNT * TX_PACKET_SPACING_US. So
+    // transitions that would need faster steps take longer than requested.
+    const unsigned long TRANSITION_MIN_STEP_INTERVAL_MS = 50;
+
+    // The size in bytes of the buffer holding log messages until they are written to the serial port.
+    const size_t LOG_BUFFER_SIZE = 2048;
+
+    // The maximum length of a single log message. Longer messages are truncated.
+    const size_t LOG_LINE_LENGTH = 160;
+
+    // The maximum number of bytes of log messages sent in one MQTT message while the debug log is enabled.
+    const size_t LOG_MQTT_CHUNK_SIZE = 512;
+
+    // The interval in milliseconds in which log messages are sent via MQTT while the debug log is enabled.
+    const unsigned long LOG_MQTT_INTERVAL_MS = 1000;
+
+    // How long to wait for a connection using the cached access point, before falling back to a scan.
+    const unsigned long WIFI_FAST_CONNECT_TIMEOUT_MS = 3000;
+    // How long to wait for a connection after scanning, before restarting the controller.
+    const unsigned long WIFI_CONNECT_TIMEOUT_MS = 60000;
+    // How often to check whether the connection is established.
+    const unsigned long WIFI_CONNECT_POLL_INTERVAL_MS = 10;
+
+    // The duration in microseconds of a single loop iteration, from which on it is reported as a stall.
+    const uint32_t LOOP_STALL_THRESHOLD_US = 50000;
+
+    // The maximum number of tagged sections the loop profiler keeps statistics for.
+    const uint8_t PROFILER_MAX_SECTIONS = 16;
+
+    // The number of slowest sections the loop profiler reports.
+    const uint8_t PROFILER_MAX_WORST = 5;
+
+    // The maximum number of stalls that are kept until they are sent via MQTT.
+    const uint8_t PROFILER_MAX_STALLS = 8;
+
+    // The maximum number of captured packages that are sent in one MQTT message while capture mode is enabled.
+    const uint8_t CAPTURE_BATCH_RECORDS = 24;
+
+    // The maximum time in milliseconds a captured package is held back before the batch is sent anyway.
+    const unsigned long CAPTURE_FLUSH_INTERVAL_MS = 1000;
+
+    // The time in milliseconds after the last turn of a remote's knob, after which the turn is considered finished.
+    // All turn events of one remote within this window are merged into a single gesture.
+    const unsigned long GESTURE_WINDOW_MS = 300;
+
+    // The maximum duration in milliseconds of a single gesture. Longer turns are split into multiple gestures, so
+    // automations can react while the knob is still being turned.
+    const unsigned long GESTURE_MAX_DURATION_MS = 1000;
+
+    // The time in milliseconds controllers in cluster mode wait for claims of other controllers, before publishing an
+    // event they received. It must cover the round trip through the MQTT broker, but delays every published action.
+    const unsigned long CLUSTER_CLAIM_WINDOW_MS = 150;
+
+    // The maximum number of own claims waiting for their window to end. If all are in use, events are published
+    // right away, which might lead to duplicates, but never loses one.
+    const uint8_t CLUSTER_MAX_CLAIMS = 8;
+
+    // The number of recent claims of other controllers that are remembered, for events this controller receives later
+    // than the others.
+    const uint8_t CLUSTER_MAX_FOREIGN_CLAIMS = 16;
+
+    // The maximum length of a client ID of another controller, including the terminating null character.
+    const uint8_t CLUSTER_CLIENT_ID_LENGTH = 32;
 };
 
 struct SerialWithName
@@ -29,4 +189,25 @@ struct SerialWithName
     const char *name;
 };
 
+struct RemoteBinding
+{
+    uint32_t remote;
+    uint32_t lightbar;
+};
+
+struct Calibration
+{
+    // The coolest and warmest color temperature of the light bar in mireds.
+    uint16_t minMireds;
+    uint16_t maxMireds;
+    // The brightness curve, 1.0 is linear.
+    float gamma;
+};
+
+struct LightbarCalibration
+{
+    uint32_t serial;
+    Calibration calibration;
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,179 @@
+#include <LittleFS.h>
+
+#include "device_store.h"
+#include "logger.h"
+
+DeviceStore::DeviceStore()
+{
+}
+
+DeviceStore::~DeviceStore()
+{
+}
+
+bool DeviceStore::begin(const SerialWithName *lightbars, uint8_t numLightbars, const SerialWithName *remotes, uint8_t numRemotes)
+{
+    this->configHash = DeviceStore::hashConfig(remotes, numRemotes, DeviceStore::hashConfig(lightbars, numLightbars, DeviceStore::hash(nullptr, 0)));
+
+    this->mounted = LittleFS.begin();
+    if (!this->mounted)
+        LOG_ERROR("[DeviceStore] Could not mount LittleFS, changes to the devices will be lost on restart!");
+    else if (this->load())
+        return true;
+
+    memset(this->slots, 0, sizeof(this->slots));
+    this->seed(lightbars, numLightbars, DeviceRecord::Type::LIGHTBAR);
+    this->seed(remotes, numRemotes, DeviceRecord::Type::REMOTE);
+    LOG_INFO("[DeviceStore] Using the devices from config.h.");
+    return this->save();
+}
+
+bool DeviceStore::load()
+{
+    File file = LittleFS.open(constants::DEVICE_STORE_PATH, "r");
+    if (!file)
+        return false;
+
+    DeviceFileHeader header;
+    bool valid = file.read((uint8_t *)&header, sizeof(header)) == sizeof(header) &&
+                 header.magic == DeviceStore::FILE_MAGIC && header.version == DeviceStore::FILE_VERSION &&
+                 header.count <= DeviceStore::NUM_SLOTS;
+    if (valid && header.configHash != this->configHash)
+    {
+        LOG_INFO("[DeviceStore] config.h changed since the devices were saved, starting over.");
+        valid = false;
+    }
+    if (valid)
+    {
+        memset(this->slots, 0, sizeof(this->slots));
+        size_t length = header.count * sizeof(DeviceRecord);
+        valid = file.read((uint8_t *)this->slots, length) == length &&
+                header.checksum == DeviceStore::hash((const uint8_t *)this->slots, length);
+        if (!valid)
+            LOG_ERROR("[DeviceStore] %s is damaged, ignoring it.", constants::DEVICE_STORE_PATH);
+    }
+    file.close();
+    if (!valid)
+        return false;
+
+    LOG_INFO("[DeviceStore] Loaded %u devices from %s.", header.count, constants::DEVICE_STORE_PATH);
+    return true;
+}
+
+bool DeviceStore::save()
+{
+    if (!this->mounted)
+        return false;
+
+    // Only write the used slots. Their order changes, but the names referenced by devices stay where they are.
+    DeviceRecord records[DeviceStore::NUM_SLOTS];
+    uint16_t count = 0;
+    for (int i = 0; i < DeviceStore::NUM_SLOTS; i++)
+    {
+        if (this->slots[i].type != DeviceRecord::Type::NONE)
+            records[count++] = this->slots[i];
+    }
+    size_t length = count * sizeof(DeviceRecord);
+    DeviceFileHeader header = {DeviceStore::FILE_MAGIC, DeviceStore::FILE_VERSION, count, this->configHash, DeviceStore::hash((const uint8_t *)records, length)};
+
+    // Write to a temporary file first, so a power loss never leaves a half written store behind.
+    String temporaryPath = String(constants::DEVICE_STORE_PATH) + ".tmp";
+    File file = LittleFS.open(temporaryPath.c_str(), "w");
+    if (!file)
+    {
+        LOG_ERROR("[DeviceStore] Could not open %s for writing!", temporaryPath.c_str());
+        return false;
+    }
+    bool written = file.write((const uint8_t *)&header, sizeof(header)) == sizeof(header) &&
+                   file.write((const uint8_t *)records, length) == length;
+    file.close();
+    if (!written || !LittleFS.rename(temporaryPath.c_str(), constants::DEVICE_STORE_PATH))
+    {
+        LOG_ERROR("[DeviceStore] Could not save the devices!");
+        LittleFS.remove(temporaryPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+const DeviceRecord *DeviceStore::add(DeviceRecord::Type type, uint32_t serial, const char *name)
+{
+    if (this->find(type, serial) != nullptr)
+        return nullptr;
+
+    for (int i = 0; i < DeviceStore::NUM_SLOTS; i++)
+    {
+        DeviceRecord *record = &this->slots[i];
+        if (record->type != DeviceRecord::Type::NONE)
+            continue;
+        record->type = type;
+        record->serial = serial;
+        strncpy(record->name, name, sizeof(record->name) - 1);
+        record->name[sizeof(record->name) - 1] = '\0';
+        return record;
+    }
+
+    LOG_ERROR("[DeviceStore] Could not add device, because all %u slots are used!", DeviceStore::NUM_SLOTS);
+    return nullptr;
+}
+
+bool DeviceStore::remove(DeviceRecord::Type type, uint32_t serial)
+{
+    DeviceRecord *record = (DeviceRecord *)this->find(type, serial);
+    if (record == nullptr)
+        return false;
+    // The slot stays where it is, so the names of the other devices don't move.
+    memset(record, 0, sizeof(DeviceRecord));
+    return true;
+}
+
+const DeviceRecord *DeviceStore::find(DeviceRecord::Type type, uint32_t serial)
+{
+    for (int i = 0; i < DeviceStore::NUM_SLOTS; i++)
+    {
+        if (this->slots[i].type == type && this->slots[i].serial == serial)
+            return &this->slots[i];
+    }
+    return nullptr;
+}
+
+uint8_t DeviceStore::getNumSlots()
+{
+    return DeviceStore::NUM_SLOTS;
+}
+
+const DeviceRecord *DeviceStore::getSlot(uint8_t index)
+{
+    return &this->slots[index];
+}
+
+void DeviceStore::seed(const SerialWithName *devices, uint8_t numDevices, DeviceRecord::Type type)
+{
+    for (int i = 0; i < numDevices; i++)
+    {
+        this->add(type, devices[i].serial, devices[i].name);
+    }
+}
+
+uint32_t DeviceStore::hashConfig(const SerialWithName *devices, uint8_t numDevices, uint32_t hash)
+{
+    // Include the number of devices, so moving one from LIGHTBARS to REMOTES changes the hash as well.
+    hash = DeviceStore::hash(&numDevices, sizeof(numDevices), hash);
+    for (int i = 0; i < numDevices; i++)
+    {
+        hash = DeviceStore::hash((const uint8_t *)&devices[i].serial, sizeof(devices[i].serial), hash);
+        hash = DeviceStore::hash((const uint8_t *)devices[i].name, strlen(devices[i].name), hash);
+    }
+    return hash;
+}
+
+uint32_t DeviceStore::hash(const uint8_t *data, size_t length, uint32_t hash)
+{
+    // FNV-1a
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= data[i];
+        hash *= 16777619UL;
+    }
+    return hash;
+}
@@ -0,0 +1,66 @@
+#ifndef DEVICE_STORE_H
+#define DEVICE_STORE_H
+
+#include "constants.h"
+
+struct DeviceRecord
+{
+    enum Type : uint8_t
+    {
+        NONE,
+        LIGHTBAR,
+        REMOTE
+    };
+
+    Type type;
+    uint32_t serial;
+    char name[constants::DEVICE_NAME_LENGTH];
+};
+
+struct DeviceFileHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    // Hash of LIGHTBARS and REMOTES in config.h at the time the file was written.
+    uint32_t configHash;
+    // Hash of all records following the header.
+    uint32_t checksum;
+};
+
+/*
+ * Keeps the light bars and remotes in fixed slots, which own the names, so they can be referenced as long as the
+ * device exists. The used slots are saved to LittleFS as a header followed by the plain records. The file is only
+ * used as long as LIGHTBARS and REMOTES in config.h don't change. After flashing a changed configuration, the store
+ * starts over with it.
+ */
+class DeviceStore
+{
+public:
+    DeviceStore();
+    ~DeviceStore();
+
+    bool begin(const SerialWithName *lightbars, uint8_t numLightbars, const SerialWithName *remotes, uint8_t numRemotes);
+    bool save();
+    const DeviceRecord *add(DeviceRecord::Type type, uint32_t serial, const char *name);
+    bool remove(DeviceRecord::Type type, uint32_t serial);
+    const DeviceRecord *find(DeviceRecord::Type type, uint32_t serial);
+    uint8_t getNumSlots();
+    const DeviceRecord *getSlot(uint8_t index);
+
+private:
+    static const uint32_t FILE_MAGIC = 0x4C324D44;
+    static const uint16_t FILE_VERSION = 1;
+    static const uint8_t NUM_SLOTS = constants::MAX_LIGHTBARS + constants::MAX_REMOTES;
+
+    DeviceRecord slots[DeviceStore::NUM_SLOTS] = {};
+    bool mounted = false;
+    uint32_t configHash = 0;
+
+    bool load();
+    void seed(const SerialWithName *devices, uint8_t numDevices, DeviceRecord::Type type);
+    static uint32_t hashConfig(const SerialWithName *devices, uint8_t numDevices, uint32_t hash);
+    static uint32_t hash(const uint8_t *data, size_t length, uint32_t hash = 2166136261UL);
+};
+
+#endif
@@ -0,0 +1,268 @@
+#include "devices.h"
+#include "logger.h"
+
+Devices::Devices(Radio *radio, MQTT *mqtt, Bindings *bindings, DeviceStore *store)
+{
+    this->radio = radio;
+    this->mqtt = mqtt;
+    this->bindings = bindings;
+    this->store = store;
+
+    // Light bars only keep commands in their state that were actually sent.
+    this->radio->setCommandListener([this](uint32_t serial, uint16_t id, bool sent)
+                                    {
+        Lightbar *lightbar = this->findLightbar(serial);
+        if (lightbar != nullptr)
+            lightbar->onCommandResult(id, sent); });
+}
+
+Devices::~Devices()
+{
+}
+
+void Devices::setCalibrations(const LightbarCalibration *calibrations, const CalibrationTable *tables, uint8_t numCalibrations)
+{
+    this->calibrations = calibrations;
+    this->calibrationTables = tables;
+    this->numCalibrations = numCalibrations;
+}
+
+void Devices::setBindings(const RemoteBinding *bindings, uint8_t numBindings)
+{
+    this->remoteBindings = bindings;
+    this->numRemoteBindings = numBindings;
+}
+
+void Devices::setup()
+{
+    // Remotes first, so the light bars find them.
+    for (int i = 0; i < this->store->getNumSlots(); i++)
+    {
+        const DeviceRecord *record = this->store->getSlot(i);
+        if (record->type == DeviceRecord::Type::REMOTE)
+            this->createRemote(record);
+    }
+    for (int i = 0; i < this->store->getNumSlots(); i++)
+    {
+        const DeviceRecord *record = this->store->getSlot(i);
+        if (record->type == DeviceRecord::Type::LIGHTBAR)
+            this->createLightbar(record);
+    }
+
+    for (int i = 0; i < this->numRemoteBindings; i++)
+    {
+        if (this->findRemote(this->remoteBindings[i].remote) == nullptr || this->findLightbar(this->remoteBindings[i].lightbar) == nullptr)
+            LOG_WARNING("[Devices] Ignoring binding of unknown remote 0x%06X or light bar 0x%06X for now.", this->remoteBindings[i].remote, this->remoteBindings[i].lightbar);
+    }
+}
+
+Lightbar *Devices::addLightbar(uint32_t serial, const char *name)
+{
+    if (this->findLightbar(serial) != nullptr)
+        return nullptr;
+    const DeviceRecord *record = this->store->add(DeviceRecord::Type::LIGHTBAR, serial, name);
+    if (record == nullptr)
+        return nullptr;
+
+    Lightbar *lightbar = this->createLightbar(record);
+    if (lightbar == nullptr)
+    {
+        this->store->remove(DeviceRecord::Type::LIGHTBAR, serial);
+        return nullptr;
+    }
+    this->store->save();
+    LOG_INFO("[Devices] Light bar %s added.", lightbar->getSerialString().c_str());
+    return lightbar;
+}
+
+Remote *Devices::addRemote(uint32_t serial, const char *name)
+{
+    if (this->findRemote(serial) != nullptr)
+        return nullptr;
+    const DeviceRecord *record = this->store->add(DeviceRecord::Type::REMOTE, serial, name);
+    if (record == nullptr)
+        return nullptr;
+
+    Remote *remote = this->createRemote(record);
+    if (remote == nullptr)
+    {
+        this->store->remove(DeviceRecord::Type::REMOTE, serial);
+        return nullptr;
+    }
+    this->store->save();
+    LOG_INFO("[Devices] Remote %s added.", remote->getSerialString().c_str());
+    return remote;
+}
+
+bool Devices::removeLightbar(uint32_t serial)
+{
+    for (int i = 0; i < this->numLightbars; i++)
+    {
+        Lightbar *lightbar = this->lightbars[i];
+        if (lightbar->getSerial() != serial)
+            continue;
+
+        // Frees the package ids of the serial, unless a remote still uses them.
+        if (!this->radio->removeLightbar(serial))
+            return false;
+        this->mqtt->removeLightbar(lightbar);
+        this->bindings->removeLightbar(lightbar);
+        for (int j = 0; j < this->numRemotes; j++)
+        {
+            this->remotes[j]->unregisterCommandListeners(lightbar);
+        }
+        for (int j = i; j < this->numLightbars - 1; j++)
+        {
+            this->lightbars[j] = this->lightbars[j + 1];
+        }
+        this->numLightbars--;
+
+        LOG_INFO("[Devices] Light bar %s removed.", lightbar->getSerialString().c_str());
+        delete lightbar;
+        this->store->remove(DeviceRecord::Type::LIGHTBAR, serial);
+        this->store->save();
+        return true;
+    }
+    return false;
+}
+
+bool Devices::removeRemote(uint32_t serial)
+{
+    for (int i = 0; i < this->numRemotes; i++)
+    {
+        Remote *remote = this->remotes[i];
+        if (remote->getSerial() != serial)
+            continue;
+
+        // Stop receiving first, events that are still queued are dropped once the remote is gone.
+        if (!this->radio->removeRemote(remote))
+            return false;
+        this->mqtt->removeRemote(remote);
+        this->bindings->removeRemote(remote);
+        for (int j = i; j < this->numRemotes - 1; j++)
+        {
+            this->remotes[j] = this->remotes[j + 1];
+        }
+        this->numRemotes--;
+
+        LOG_INFO("[Devices] Remote %s removed.", remote->getSerialString().c_str());
+        delete remote;
+        this->store->remove(DeviceRecord::Type::REMOTE, serial);
+        this->store->save();
+        return true;
+    }
+    return false;
+}
+
+Lightbar *Devices::findLightbar(uint32_t serial)
+{
+    for (int i = 0; i < this->numLightbars; i++)
+    {
+        if (this->lightbars[i]->getSerial() == serial)
+            return this->lightbars[i];
+    }
+    return nullptr;
+}
+
+Remote *Devices::findRemote(uint32_t serial)
+{
+    for (int i = 0; i < this->numRemotes; i++)
+    {
+        if (this->remotes[i]->getSerial() == serial)
+            return this->remotes[i];
+    }
+    return nullptr;
+}
+
+uint8_t Devices::getNumLightbars()
+{
+    return this->numLightbars;
+}
+
+Lightbar *Devices::getLightbar(uint8_t index)
+{
+    return this->lightbars[index];
+}
+
+uint8_t Devices::getNumRemotes()
+{
+    return this->numRemotes;
+}
+
+Remote *Devices::getRemote(uint8_t index)
+{
+    return this->remotes[index];
+}
+
+Lightbar *Devices::createLightbar(const DeviceRecord *record)
+{
+    if (this->numLightbars >= constants::MAX_LIGHTBARS)
+        return nullptr;
+
+    const CalibrationTable *calibration = &calibration::DEFAULT_TABLE;
+    for (int i = 0; i < this->numCalibrations; i++)
+    {
+        if (this->calibrations[i].serial == record->serial)
+            calibration = &this->calibrationTables[i];
+    }
+
+    if (!this->radio->addLightbar(record->serial))
+        return nullptr;
+
+    // The name lives in the store's slot as long as the light bar exists.
+    Lightbar *lightbar = new Lightbar(this->radio, record->serial, record->name, calibration);
+    if (!this->mqtt->addLightbar(lightbar))
+    {
+        this->radio->removeLightbar(record->serial);
+        delete lightbar;
+        return nullptr;
+    }
+    this->lightbars[this->numLightbars] = lightbar;
+    this->numLightbars++;
+
+    for (int i = 0; i < this->numRemotes; i++)
+    {
+        this->connect(this->remotes[i], lightbar);
+    }
+    return lightbar;
+}
+
+Remote *Devices::createRemote(const DeviceRecord *record)
+{
+    if (this->numRemotes >= constants::MAX_REMOTES)
+        return nullptr;
+
+    Remote *remote = new Remote(this->radio, record->serial, record->name);
+    if (this->radio->findRemote(record->serial) != remote)
+    {
+        delete remote;
+        return nullptr;
+    }
+    if (!this->mqtt->addRemote(remote))
+    {
+        this->radio->removeRemote(remote);
+        delete remote;
+        return nullptr;
+    }
+    this->remotes[this->numRemotes] = remote;
+    this->numRemotes++;
+
+    for (int i = 0; i < this->numLightbars; i++)
+    {
+        this->connect(remote, this->lightbars[i]);
+    }
+    return remote;
+}
+
+void Devices::connect(Remote *remote, Lightbar *lightbar)
+{
+    // A remote with the same serial controls the light bar directly, keep track of its changes.
+    if (remote->getSerial() == lightbar->getSerial())
+        lightbar->trackRemote(remote);
+
+    for (int i = 0; i < this->numRemoteBindings; i++)
+    {
+        if (this->remoteBindings[i].remote == remote->getSerial() && this->remoteBindings[i].lightbar == lightbar->getSerial())
+            this->bindings->bind(remote, lightbar);
+    }
+}
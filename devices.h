@@ -0,0 +1,61 @@
+#ifndef DEVICES_H
+#define DEVICES_H
+
+#include "constants.h"
+#include "radio.h"
+#include "lightbar.h"
+#include "remote.h"
+#include "binding.h"
+#include "mqtt.h"
+#include "device_store.h"
+#include "calibration.h"
+
+/*
+ * Creates the light bars and remotes of the device store and keeps everything that references them in sync, so they
+ * can be added and removed while the controller is running. Every change is saved to the store right away.
+ */
+class Devices
+{
+public:
+    Devices(Radio *radio, MQTT *mqtt, Bindings *bindings, DeviceStore *store);
+    ~Devices();
+
+    void setCalibrations(const LightbarCalibration *calibrations, const CalibrationTable *tables, uint8_t numCalibrations);
+    void setBindings(const RemoteBinding *bindings, uint8_t numBindings);
+    void setup();
+
+    Lightbar *addLightbar(uint32_t serial, const char *name);
+    Remote *addRemote(uint32_t serial, const char *name);
+    bool removeLightbar(uint32_t serial);
+    bool removeRemote(uint32_t serial);
+    Lightbar *findLightbar(uint32_t serial);
+    Remote *findRemote(uint32_t serial);
+
+    uint8_t getNumLightbars();
+    Lightbar *getLightbar(uint8_t index);
+    uint8_t getNumRemotes();
+    Remote *getRemote(uint8_t index);
+
+private:
+    Radio *radio;
+    MQTT *mqtt;
+    Bindings *bindings;
+    DeviceStore *store;
+
+    const LightbarCalibration *calibrations = nullptr;
+    const CalibrationTable *calibrationTables = nullptr;
+    uint8_t numCalibrations = 0;
+    const RemoteBinding *remoteBindings = nullptr;
+    uint8_t numRemoteBindings = 0;
+
+    Lightbar *lightbars[constants::MAX_LIGHTBARS];
+    uint8_t numLightbars = 0;
+    Remote *remotes[constants::MAX_REMOTES];
+    uint8_t numRemotes = 0;
+
+    Lightbar *createLightbar(const DeviceRecord *record);
+    Remote *createRemote(const DeviceRecord *record);
+    void connect(Remote *remote, Lightbar *lightbar);
+};
+
+#endif
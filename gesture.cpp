@@ -0,0 +1,135 @@
+#include "gesture.h"
+#include "lightbar.h"
+
+unsigned long Gesture::getDuration()
+{
+    return this->last - this->started;
+}
+
+float Gesture::getVelocity()
+{
+    // A single event has no duration, treat it as if it took one gesture window.
+    unsigned long duration = max(this->getDuration(), constants::GESTURE_WINDOW_MS);
+    return this->steps * 1000.0 / duration;
+}
+
+GestureAggregator::GestureAggregator(std::function<void(Gesture *)> callback)
+{
+    this->callback = callback;
+}
+
+GestureAggregator::~GestureAggregator()
+{
+}
+
+bool GestureAggregator::handle(Remote *remote, byte command, byte options)
+{
+    byte positive_command;
+    int8_t direction;
+    switch ((uint8_t)command)
+    {
+    case Lightbar::Command::BRIGHTER:
+        positive_command = Lightbar::Command::BRIGHTER;
+        direction = 1;
+        break;
+
+    case Lightbar::Command::DIMMER:
+        positive_command = Lightbar::Command::BRIGHTER;
+        direction = -1;
+        break;
+
+    case Lightbar::Command::COOLER:
+        positive_command = Lightbar::Command::COOLER;
+        direction = 1;
+        break;
+
+    case Lightbar::Command::WARMER:
+        positive_command = Lightbar::Command::COOLER;
+        direction = -1;
+        break;
+
+    default:
+        // Anything else ends a running gesture, so events are reported in order.
+        this->flush(remote);
+        return false;
+    }
+
+    // The options contain the number of steps the knob was turned. Fast turns might report more than one.
+    int16_t steps = abs((int8_t)options);
+    if (steps == 0)
+        steps = 1;
+
+    unsigned long now = millis();
+    Gesture *gesture = nullptr;
+    for (int i = 0; i < this->numGestures; i++)
+    {
+        if (this->gestures[i].remote != remote)
+            continue;
+        if (this->gestures[i].command != positive_command)
+        {
+            this->emit(i);
+            break;
+        }
+        gesture = &this->gestures[i];
+        break;
+    }
+
+    if (gesture == nullptr)
+    {
+        if (this->numGestures >= constants::MAX_REMOTES)
+            return false;
+        gesture = &this->gestures[this->numGestures];
+        this->numGestures++;
+        gesture->remote = remote;
+        gesture->command = positive_command;
+        gesture->steps = 0;
+        gesture->events = 0;
+        gesture->sequence = remote->getLastPackageId();
+        gesture->rpd = remote->getLastRpd();
+        gesture->started = now;
+    }
+
+    gesture->steps += direction * steps;
+    gesture->events++;
+    gesture->lastSequence = remote->getLastPackageId();
+    gesture->last = now;
+    return true;
+}
+
+void GestureAggregator::flush(Remote *remote)
+{
+    for (int i = 0; i < this->numGestures; i++)
+    {
+        if (this->gestures[i].remote == remote)
+        {
+            this->emit(i);
+            return;
+        }
+    }
+}
+
+void GestureAggregator::loop()
+{
+    unsigned long now = millis();
+    for (int i = this->numGestures - 1; i >= 0; i--)
+    {
+        if (now - this->gestures[i].last >= constants::GESTURE_WINDOW_MS ||
+            now - this->gestures[i].started >= constants::GESTURE_MAX_DURATION_MS)
+            this->emit(i);
+    }
+}
+
+void GestureAggregator::emit(uint8_t index)
+{
+    Gesture gesture = this->gestures[index];
+    for (int i = index; i < this->numGestures - 1; i++)
+    {
+        this->gestures[i] = this->gestures[i + 1];
+    }
+    this->numGestures--;
+
+    // Turns back and forth that cancel each other out don't change anything, there is nothing to report.
+    if (gesture.steps == 0)
+        return;
+    this->callback(&gesture);
+}
@@ -0,0 +1,47 @@
+#ifndef GESTURE_H
+#define GESTURE_H
+
+#include "constants.h"
+#include "remote.h"
+
+class Remote;
+
+struct Gesture
+{
+    Remote *remote;
+    // The command of the positive direction, i.e. BRIGHTER or COOLER.
+    byte command;
+    // Positive for clockwise turns, negative for counterclockwise turns.
+    int16_t steps;
+    uint16_t events;
+    // The sequence numbers of the first and the last event, which identify the gesture across controllers, and the
+    // signal strength of the first one.
+    uint8_t sequence;
+    uint8_t lastSequence;
+    bool rpd;
+    unsigned long started;
+    unsigned long last;
+
+    unsigned long getDuration();
+    // The velocity of the turn in steps per second.
+    float getVelocity();
+};
+
+class GestureAggregator
+{
+public:
+    GestureAggregator(std::function<void(Gesture *)> callback);
+    ~GestureAggregator();
+    bool handle(Remote *remote, byte command, byte options);
+    void flush(Remote *remote);
+    void loop();
+
+private:
+    std::function<void(Gesture *)> callback;
+    Gesture gestures[constants::MAX_REMOTES];
+    uint8_t numGestures = 0;
+
+    void emit(uint8_t index);
+};
+
+#endif
@@ -0,0 +1,136 @@
+#include "learner.h"
+#include "logger.h"
+
+RemoteLearner::RemoteLearner()
+{
+}
+
+RemoteLearner::~RemoteLearner()
+{
+}
+
+void RemoteLearner::setEnabled(bool enabled)
+{
+    if (this->enabled == enabled)
+        return;
+    this->enabled = enabled;
+    // Every learning session starts with an empty table. The candidates stay around after disabling, so
+    // they can still be promoted.
+    if (enabled)
+    {
+        this->numCandidates = 0;
+        this->evictions = 0;
+    }
+    this->changed = true;
+    LOG_INFO(enabled ? "[Learner] enabled!" : "[Learner] disabled!");
+}
+
+bool RemoteLearner::isEnabled()
+{
+    return this->enabled;
+}
+
+void RemoteLearner::observe(uint32_t serial, uint8_t packageId)
+{
+    if (!this->enabled)
+        return;
+
+    Candidate candidate;
+    int index = -1;
+    for (int i = 0; i < this->numCandidates; i++)
+    {
+        if (this->candidates[i].serial == serial)
+        {
+            index = i;
+            break;
+        }
+    }
+
+    if (index >= 0)
+    {
+        candidate = this->candidates[index];
+        candidate.frames++;
+        // Remotes repeat every package multiple times, only count new ones.
+        if (packageId != candidate.lastPackageId)
+        {
+            candidate.events++;
+            this->changed = true;
+        }
+    }
+    else
+    {
+        if (this->numCandidates >= constants::LEARN_MAX_CANDIDATES)
+        {
+            LOG_DEBUG("[Learner] Forgetting candidate 0x%06X", this->candidates[this->numCandidates - 1].serial);
+            this->numCandidates--;
+            this->evictions++;
+        }
+        index = this->numCandidates;
+        this->numCandidates++;
+        candidate = {serial, 1, 1, packageId, millis(), millis()};
+        this->changed = true;
+        LOG_INFO("[Learner] New candidate 0x%06X", serial);
+    }
+    candidate.lastPackageId = packageId;
+    candidate.lastSeen = millis();
+
+    // Move the candidate to the front.
+    for (int i = index; i > 0; i--)
+    {
+        this->candidates[i] = this->candidates[i - 1];
+    }
+    this->candidates[0] = candidate;
+}
+
+const Candidate *RemoteLearner::findCandidate(uint32_t serial)
+{
+    for (int i = 0; i < this->numCandidates; i++)
+    {
+        if (this->candidates[i].serial == serial)
+            return &this->candidates[i];
+    }
+    return nullptr;
+}
+
+bool RemoteLearner::remove(uint32_t serial)
+{
+    for (int i = 0; i < this->numCandidates; i++)
+    {
+        if (this->candidates[i].serial == serial)
+        {
+            for (int j = i; j < this->numCandidates - 1; j++)
+            {
+                this->candidates[j] = this->candidates[j + 1];
+            }
+            this->numCandidates--;
+            this->changed = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint8_t RemoteLearner::getNumCandidates()
+{
+    return this->numCandidates;
+}
+
+const Candidate *RemoteLearner::getCandidate(uint8_t index)
+{
+    return &this->candidates[index];
+}
+
+uint32_t RemoteLearner::getEvictions()
+{
+    return this->evictions;
+}
+
+bool RemoteLearner::hasChanged()
+{
+    return this->changed;
+}
+
+void RemoteLearner::clearChanged()
+{
+    this->changed = false;
+}
@@ -0,0 +1,48 @@
+#ifndef LEARNER_H
+#define LEARNER_H
+
+#include "constants.h"
+
+struct Candidate
+{
+    uint32_t serial;
+    // Number of valid frames received from this serial.
+    uint32_t frames;
+    // Number of different sequence numbers, i.e. button presses and turns.
+    uint16_t events;
+    uint8_t lastPackageId;
+    unsigned long firstSeen;
+    unsigned long lastSeen;
+};
+
+/*
+ * Keeps track of serials that send valid packages, but are not known yet. The table is bounded, if it is full,
+ * the serial that was seen least recently is replaced. Candidates are ordered by when they were seen last, the
+ * most recent one first.
+ */
+class RemoteLearner
+{
+public:
+    RemoteLearner();
+    ~RemoteLearner();
+
+    void setEnabled(bool enabled);
+    bool isEnabled();
+    void observe(uint32_t serial, uint8_t packageId);
+    const Candidate *findCandidate(uint32_t serial);
+    bool remove(uint32_t serial);
+    uint8_t getNumCandidates();
+    const Candidate *getCandidate(uint8_t index);
+    uint32_t getEvictions();
+    bool hasChanged();
+    void clearChanged();
+
+private:
+    bool enabled = false;
+    bool changed = false;
+    Candidate candidates[constants::LEARN_MAX_CANDIDATES];
+    uint8_t numCandidates = 0;
+    uint32_t evictions = 0;
+};
+
+#endif
@@ -1,8 +1,9 @@
 #include "lightbar.h"
 
-Lightbar::Lightbar(Radio *radio, uint32_t serial, const char *name)
+Lightbar::Lightbar(Radio *radio, uint32_t serial, const char *name, const CalibrationTable *calibration)
 {
     this->radio = radio;
+    this->calibration = calibration;
     this->serial = serial;
     this->name = name;
 
@@ -28,25 +29,60 @@ const char *Lightbar::getName()
     return this->name;
 }
 
+void Lightbar::sendRawCommand(Command command, byte options, Radio::Priority priority, bool supersede)
+{
+    // The radio might still drop the command, e.g. if its queue is full. Until it reports back, the command only
+    // counts as pending.
+    uint16_t id;
+    if (!this->radio->sendCommand(this->serial, command, options, priority, supersede, &id))
+        return;
+
+    if (this->numPending >= constants::LIGHTBAR_MAX_PENDING_COMMANDS)
+    {
+        // The result of the oldest command got lost, assume it was sent. Being assumed, it can't make anything known.
+        Lightbar::applyCommand(&this->confirmed, this->pending[0].command, this->pending[0].options);
+        this->removePending(0);
+    }
+    this->pending[this->numPending] = {id, (byte)command, options};
+    this->numPending++;
+    this->updateState();
+}
+
+void Lightbar::onCommandResult(uint16_t id, bool sent)
+{
+    for (int i = 0; i < this->numPending; i++)
+    {
+        if (this->pending[i].id != id)
+            continue;
+        PendingCommand command = this->pending[i];
+        this->removePending(i);
+        if (sent)
+            this->confirmCommand(command.command, command.options);
+        else
+            this->updateState();
+        return;
+    }
+}
+
 void Lightbar::sendRawCommand(Command command, byte options)
 {
-    this->radio->sendCommand(serial, command, options);
+    Radio::Priority priority = command == Command::ON_OFF || command == Command::RESET ? Radio::Priority::INTERACTIVE : Radio::Priority::NORMAL;
+    this->sendRawCommand(command, options, priority);
 }
 
 void Lightbar::sendRawCommand(Command command)
 {
-    this->radio->sendCommand(serial, command);
+    this->sendRawCommand(command, 0x0);
 }
 
 void Lightbar::onOff()
 {
     this->sendRawCommand(Lightbar::Command::ON_OFF);
-    onState = !onState;
 }
 
 void Lightbar::setOnOff(bool on)
 {
-    if (onState != on)
+    if (this->state.on != on)
         this->onOff();
 }
 
@@ -85,16 +121,34 @@ void Lightbar::setTemperature(uint8_t value)
     // Send max value first, then set to the desired value. See
     // https://github.com/lamperez/xiaomi-lightbar-nrf24?tab=readme-ov-file#command-codes
     // for details.
-    this->sendRawCommand(Lightbar::Command::COOLER, 0x0 - 16);
+    // Setting an absolute value makes all queued steps in between pointless.
+    this->sendRawCommand(Lightbar::Command::COOLER, 0x0 - 16, Radio::Priority::NORMAL, true);
     this->sendRawCommand(Lightbar::Command::WARMER, (byte)value);
 }
 
 void Lightbar::setMiredTemperature(uint mireds)
 {
-    mireds = max(mireds, (uint)153);
-    mireds = min(mireds, (uint)370);
-    float amount = ((1 - ((mireds - 153) * 1.0 / (370 - 153) * 1.0)) * 15) + 0.5;
-    this->setTemperature((uint8_t)amount);
+    this->setTemperature(this->miredsToTemperature(mireds));
+}
+
+uint8_t Lightbar::miredsToTemperature(uint mireds)
+{
+    return this->calibration->miredsToStep(mireds);
+}
+
+uint8_t Lightbar::scaledBrightnessToBrightness(uint8_t brightness)
+{
+    return this->calibration->brightnessToStep(brightness);
+}
+
+uint16_t Lightbar::getMinMireds()
+{
+    return this->calibration->getMinMireds();
+}
+
+uint16_t Lightbar::getMaxMireds()
+{
+    return this->calibration->getMaxMireds();
 }
 
 void Lightbar::setBrightness(uint8_t value)
@@ -102,6 +156,184 @@ void Lightbar::setBrightness(uint8_t value)
     // Send max value first, then set to the desired value. See
     // https://github.com/lamperez/xiaomi-lightbar-nrf24?tab=readme-ov-file#command-codes
     // for details.
-    this->sendRawCommand(Lightbar::Command::DIMMER, 0x0 - 16);
+    this->sendRawCommand(Lightbar::Command::DIMMER, 0x0 - 16, Radio::Priority::NORMAL, true);
     this->sendRawCommand(Lightbar::Command::BRIGHTER, (byte)value);
+}
+
+void Lightbar::setScaledBrightness(uint8_t brightness)
+{
+    this->setBrightness(this->scaledBrightnessToBrightness(brightness));
+}
+
+void Lightbar::handleRemoteCommand(byte command, byte options)
+{
+    switch ((uint8_t)command)
+    {
+    case Lightbar::Command::ON_OFF:
+        this->onOff();
+        break;
+
+    case Lightbar::Command::COOLER:
+    case Lightbar::Command::WARMER:
+    case Lightbar::Command::BRIGHTER:
+    case Lightbar::Command::DIMMER:
+        this->sendRawCommand((Command)command, options);
+        break;
+
+    default:
+        // Holding the button resets the remote's own light bar. Never forward that to bound light bars.
+        break;
+    }
+}
+
+bool Lightbar::trackRemote(Remote *remote)
+{
+    // The light bar reacts to this remote on its own. Only keep the state in sync.
+    return remote->registerCommandListener([this](Remote *remote, byte command, byte options)
+                                           { this->confirmCommand(command, options); }, this);
+}
+
+const LightbarState *Lightbar::getState()
+{
+    return &this->state;
+}
+
+bool Lightbar::isStateKnown()
+{
+    // Without knowing whether the light bar is on, there is no state to report at all.
+    return this->onKnown;
+}
+
+bool Lightbar::hasPendingCommands()
+{
+    return this->numPending > 0;
+}
+
+bool Lightbar::isBrightnessKnown()
+{
+    return this->brightnessKnown;
+}
+
+bool Lightbar::isTemperatureKnown()
+{
+    return this->temperatureKnown;
+}
+
+void Lightbar::restoreOnOff(bool on)
+{
+    if (this->onKnown)
+        return;
+    this->confirmed.on = on;
+    this->onKnown = true;
+    this->updateState();
+}
+
+void Lightbar::restoreScaledBrightness(uint8_t brightness)
+{
+    if (this->brightnessKnown)
+        return;
+    this->confirmed.brightness = this->scaledBrightnessToBrightness(brightness);
+    this->brightnessKnown = true;
+    this->updateState();
+}
+
+void Lightbar::restoreMiredTemperature(uint mireds)
+{
+    if (this->temperatureKnown)
+        return;
+    this->confirmed.temperature = this->miredsToTemperature(mireds);
+    this->temperatureKnown = true;
+    this->updateState();
+}
+
+uint Lightbar::getMiredTemperature()
+{
+    return this->calibration->stepToMireds(this->state.temperature);
+}
+
+uint8_t Lightbar::getScaledBrightness()
+{
+    return this->calibration->stepToBrightness(this->state.brightness);
+}
+
+unsigned long Lightbar::getLastStateChange()
+{
+    return this->lastStateChange;
+}
+
+void Lightbar::confirmCommand(byte command, byte options)
+{
+    Lightbar::applyCommand(&this->confirmed, command, options);
+
+    // Steps across the whole range end at the same value, no matter where they started. This is how absolute values
+    // are set.
+    if (abs((int8_t)options) >= Lightbar::MAX_STEP)
+    {
+        if (command == Lightbar::Command::BRIGHTER || command == Lightbar::Command::DIMMER)
+            this->brightnessKnown = true;
+        if (command == Lightbar::Command::WARMER || command == Lightbar::Command::COOLER)
+            this->temperatureKnown = true;
+    }
+    this->updateState();
+}
+
+void Lightbar::removePending(uint8_t index)
+{
+    for (int i = index; i < this->numPending - 1; i++)
+    {
+        this->pending[i] = this->pending[i + 1];
+    }
+    this->numPending--;
+}
+
+void Lightbar::updateState()
+{
+    LightbarState previous = this->state;
+    this->state = this->confirmed;
+    for (int i = 0; i < this->numPending; i++)
+    {
+        Lightbar::applyCommand(&this->state, this->pending[i].command, this->pending[i].options);
+    }
+
+    if (memcmp(&previous, &this->state, sizeof(LightbarState)))
+        this->lastStateChange = millis();
+}
+
+void Lightbar::applyCommand(LightbarState *state, byte command, byte options)
+{
+    switch ((uint8_t)command)
+    {
+    case Lightbar::Command::ON_OFF:
+        state->on = !state->on;
+        break;
+
+    case Lightbar::Command::BRIGHTER:
+        Lightbar::changeStep(&state->brightness, 1, options);
+        break;
+
+    case Lightbar::Command::DIMMER:
+        Lightbar::changeStep(&state->brightness, -1, options);
+        break;
+
+    case Lightbar::Command::WARMER:
+        Lightbar::changeStep(&state->temperature, 1, options);
+        break;
+
+    case Lightbar::Command::COOLER:
+        Lightbar::changeStep(&state->temperature, -1, options);
+        break;
+
+    default:
+        break;
+    }
+}
+
+void Lightbar::changeStep(uint8_t *step, int8_t direction, byte options)
+{
+    // The options contain the number of steps. No options means a single step.
+    int16_t steps = abs((int8_t)options);
+    if (steps == 0)
+        steps = 1;
+    int16_t value = *step + direction * steps;
+    *step = (uint8_t)constrain(value, 0, Lightbar::MAX_STEP);
 }
\ No newline at end of file
@@ -2,11 +2,32 @@
 #define LIGHTBAR_H
 
 #include "radio.h"
+#include "remote.h"
+#include "calibration.h"
+
+class Remote;
+
+struct LightbarState
+{
+    bool on;
+    // Number of brightness steps above the minimum, 0 – 15.
+    uint8_t brightness;
+    // Number of temperature steps as used by setTemperature(), 0 – 15.
+    uint8_t temperature;
+};
+
+// A command that was handed to the radio, but not sent yet.
+struct PendingCommand
+{
+    uint16_t id;
+    byte command;
+    byte options;
+};
 
 class Lightbar
 {
 public:
-    Lightbar(Radio *radio, uint32_t serial, const char *name);
+    Lightbar(Radio *radio, uint32_t serial, const char *name, const CalibrationTable *calibration = &calibration::DEFAULT_TABLE);
     ~Lightbar();
     uint32_t getSerial();
     const String getSerialString();
@@ -22,6 +43,7 @@ public:
         RESET = 0x06
     };
 
+    void sendRawCommand(Command command, byte options, Radio::Priority priority, bool supersede = false);
     void sendRawCommand(Command command, byte options);
     void sendRawCommand(Command command);
     void onOff();
@@ -35,13 +57,54 @@ public:
     void setTemperature(uint8_t value);
     void setMiredTemperature(uint mireds);
     void setBrightness(uint8_t value);
+    void setScaledBrightness(uint8_t brightness);
+    void handleRemoteCommand(byte command, byte options);
+    void onCommandResult(uint16_t id, bool sent);
+    bool trackRemote(Remote *remote);
+    const LightbarState *getState();
+    bool isStateKnown();
+    bool hasPendingCommands();
+    bool isBrightnessKnown();
+    bool isTemperatureKnown();
+    void restoreOnOff(bool on);
+    void restoreScaledBrightness(uint8_t brightness);
+    void restoreMiredTemperature(uint mireds);
+    uint getMiredTemperature();
+    uint8_t getScaledBrightness();
+    uint8_t miredsToTemperature(uint mireds);
+    uint8_t scaledBrightnessToBrightness(uint8_t brightness);
+    uint16_t getMinMireds();
+    uint16_t getMaxMireds();
+    unsigned long getLastStateChange();
+
+    static constexpr uint8_t MAX_STEP = 15;
+    static_assert(MAX_STEP + 1 == CalibrationTable::NUM_STEPS, "The calibration tables must cover all steps");
 
 private:
     Radio *radio;
-    bool onState = false;
+    const CalibrationTable *calibration;
+    // The state of the light bar after all commands that were sent, and the state once the pending ones are sent
+    // as well. The latter is the one reported, so new commands build on it.
+    LightbarState confirmed = {false, Lightbar::MAX_STEP, 0};
+    LightbarState state = {false, Lightbar::MAX_STEP, 0};
+    PendingCommand pending[constants::LIGHTBAR_MAX_PENDING_COMMANDS];
+    uint8_t numPending = 0;
+    unsigned long lastStateChange = 0;
+    // The fields of the state are only assumed until something tells their actual value: a command across the whole
+    // range that the radio sent or a remote sent, or the state Home Assistant last knew. A toggle or a single step
+    // keeps a field unknown, if it was unknown before.
+    bool onKnown = false;
+    bool brightnessKnown = false;
+    bool temperatureKnown = false;
     uint32_t serial;
     String serialString;
     const char *name;
+
+    void confirmCommand(byte command, byte options);
+    void removePending(uint8_t index);
+    void updateState();
+    static void applyCommand(LightbarState *state, byte command, byte options);
+    static void changeStep(uint8_t *step, int8_t direction, byte options);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,106 @@
+#include "logger.h"
+
+Logger logger;
+
+Logger::Logger()
+{
+}
+
+Logger::~Logger()
+{
+}
+
+void Logger::log(const char *format, ...)
+{
+    char line[constants::LOG_LINE_LENGTH];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line) - 1, format, args);
+    va_end(args);
+    if (length < 0)
+        return;
+    length = min(length, (int)sizeof(line) - 2);
+    line[length] = '\n';
+    length++;
+
+    this->write(line, length);
+}
+
+void Logger::setSynchronous(bool synchronous)
+{
+    this->synchronous = synchronous;
+    if (synchronous)
+        this->loop();
+}
+
+void Logger::loop()
+{
+    char chunk[64];
+    int available = this->synchronous ? sizeof(chunk) : Serial.availableForWrite();
+    while (available > 0)
+    {
+        size_t length = this->read(Reader::SERIAL_READER, chunk, min((size_t)available, sizeof(chunk)));
+        if (length == 0)
+            return;
+        Serial.write((const uint8_t *)chunk, length);
+        available = this->synchronous ? sizeof(chunk) : Serial.availableForWrite();
+    }
+}
+
+size_t Logger::read(Reader reader, char *buffer, size_t size)
+{
+    this->catchUp(reader);
+
+    size_t length = min((size_t)(this->head - this->tails[reader]), size);
+    for (size_t i = 0; i < length; i++)
+    {
+        buffer[i] = this->buffer[(this->tails[reader] + i) % constants::LOG_BUFFER_SIZE];
+    }
+
+    // Prefer complete lines, as long as there is one.
+    if (reader == Reader::MQTT_READER)
+    {
+        size_t line_end = length;
+        while (line_end > 0 && buffer[line_end - 1] != '\n')
+            line_end--;
+        if (line_end > 0)
+            length = line_end;
+    }
+
+    this->tails[reader] += length;
+    return length;
+}
+
+uint32_t Logger::getDropped()
+{
+    return this->dropped;
+}
+
+void Logger::write(const char *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        this->buffer[(this->head + i) % constants::LOG_BUFFER_SIZE] = data[i];
+    }
+    this->head += length;
+
+    if (this->synchronous)
+        this->loop();
+}
+
+void Logger::catchUp(Reader reader)
+{
+    if (this->head - this->tails[reader] <= constants::LOG_BUFFER_SIZE)
+        return;
+
+    // The oldest messages were overwritten. Continue with the first complete line that is left.
+    uint32_t tail = this->head - constants::LOG_BUFFER_SIZE;
+    while (tail != this->head && this->buffer[tail % constants::LOG_BUFFER_SIZE] != '\n')
+        tail++;
+    if (tail != this->head)
+        tail++;
+
+    if (reader == Reader::SERIAL_READER)
+        this->dropped += tail - this->tails[reader];
+    this->tails[reader] = tail;
+}
@@ -0,0 +1,90 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include "constants.h"
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+// Messages above this level are removed at compile time. Either change it here or pass -DLOG_LEVEL=... to the
+// compiler.
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) logger.log(__VA_ARGS__)
+#else
+#define LOG_ERROR(...) \
+    do                 \
+    {                  \
+    } while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARNING
+#define LOG_WARNING(...) logger.log(__VA_ARGS__)
+#else
+#define LOG_WARNING(...) \
+    do                   \
+    {                    \
+    } while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) logger.log(__VA_ARGS__)
+#else
+#define LOG_INFO(...) \
+    do                \
+    {                 \
+    } while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) logger.log(__VA_ARGS__)
+#else
+#define LOG_DEBUG(...) \
+    do                 \
+    {                  \
+    } while (0)
+#endif
+
+/*
+ * Log messages are written to a ring buffer and drained to the serial port from loop(), as much as fits into the
+ * UART's FIFO without blocking. A second reader allows sending the log via MQTT. If a reader falls behind, it
+ * skips the overwritten messages.
+ */
+class Logger
+{
+public:
+    enum Reader
+    {
+        SERIAL_READER = 0,
+        MQTT_READER = 1
+    };
+
+    Logger();
+    ~Logger();
+    void log(const char *format, ...) __attribute__((format(printf, 2, 3)));
+    void setSynchronous(bool synchronous);
+    void loop();
+    size_t read(Reader reader, char *buffer, size_t size);
+    uint32_t getDropped();
+
+private:
+    char buffer[constants::LOG_BUFFER_SIZE];
+    // Positions are counted since boot and only taken modulo the buffer size on access.
+    uint32_t head = 0;
+    uint32_t tails[2] = {0, 0};
+    uint32_t dropped = 0;
+    bool synchronous = true;
+
+    void write(const char *data, size_t length);
+    void catchUp(Reader reader);
+};
+
+extern Logger logger;
+
+#endif
@@ -1,8 +1,11 @@
 #include <Arduino_JSON.h>
 
 #include "mqtt.h"
+#include "logger.h"
+#include "profiler.h"
+#include "devices.h"
 
-MQTT::MQTT(WiFiClient *wifiClient, const char *mqttServer, int mqttPort, const char *mqttUser, const char *mqttPassword, const char *mqttRootTopic, bool homeAssistantAutoDiscovery, const char *homeAssistantAutoDiscoveryPrefix)
+MQTT::MQTT(const char *mqttServer, int mqttPort, const char *mqttUser, const char *mqttPassword, const char *mqttRootTopic, bool homeAssistantAutoDiscovery, const char *homeAssistantAutoDiscoveryPrefix, bool homeAssistantDeviceDiscovery)
 {
     this->mqttServer = mqttServer;
     this->mqttPort = mqttPort;
@@ -11,18 +14,36 @@ MQTT::MQTT(WiFiClient *wifiClient, const char *mqttServer, int mqttPort, const c
     this->mqttRootTopic = String(mqttRootTopic);
     this->homeAssistantDiscovery = homeAssistantAutoDiscovery;
     this->homeAssistantDiscoveryPrefix = String(homeAssistantAutoDiscoveryPrefix);
+    this->homeAssistantDeviceDiscovery = homeAssistantDeviceDiscovery;
 
-    this->remoteCommandHandler = std::bind(&MQTT::sendAction, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
+    this->remoteCommandHandler = std::bind(&MQTT::onRemoteCommand, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
+    this->gestureAggregator = new GestureAggregator(std::bind(&MQTT::sendGesture, this, std::placeholders::_1));
 
-    this->client = new PubSubClient(*wifiClient);
+    this->client = new AsyncMqttClient();
 
     this->clientId = "l2m_" + WiFi.macAddress();
     this->combinedRootTopic = this->mqttRootTopic + "/" + this->clientId;
+    this->availabilityTopic = this->combinedRootTopic + "/availability";
 }
 
 MQTT::~MQTT()
 {
     delete this->client;
+    delete this->gestureAggregator;
+
+    while (this->outboundCount > 0)
+    {
+        free(this->outbound[this->outboundHead].payload);
+        this->outboundHead = (this->outboundHead + 1) % constants::MQTT_OUTBOUND_QUEUE_SIZE;
+        this->outboundCount--;
+    }
+    while (this->inboundCount > 0)
+    {
+        free(this->inbound[this->inboundHead].topic);
+        free(this->inbound[this->inboundHead].payload);
+        this->inboundHead = (this->inboundHead + 1) % constants::MQTT_INBOUND_QUEUE_SIZE;
+        this->inboundCount--;
+    }
 }
 
 const String MQTT::getCombinedRootTopic()
@@ -37,13 +58,84 @@ const String MQTT::getClientId()
 
 void MQTT::onMessage(char *topic, byte *payload, unsigned int length)
 {
-    Serial.print("[MQTT] New Message (");
-    Serial.print(topic);
-    Serial.print("): ");
+    PROFILE_SCOPE("mqtt.message");
     char *payload_s = (char *)malloc(length + 1);
     memcpy(payload_s, payload, length);
     payload_s[length] = '\0';
-    Serial.println(payload_s);
+    LOG_DEBUG("[MQTT] New Message (%s): %s", topic, payload_s);
+
+    if (this->capture != nullptr && !strcmp(topic, String(this->getCombinedRootTopic() + "/capture").c_str()))
+    {
+        this->capture->setEnabled(!strcmp(payload_s, "ON"));
+        free(payload_s);
+        return;
+    }
+
+    if (!strcmp(topic, String(this->getCombinedRootTopic() + "/debug").c_str()))
+    {
+        this->debugLog = !strcmp(payload_s, "ON");
+        LOG_INFO(this->debugLog ? "[MQTT] Debug log enabled!" : "[MQTT] Debug log disabled!");
+        free(payload_s);
+        return;
+    }
+
+    if (this->replay != nullptr && !strcmp(topic, String(this->getCombinedRootTopic() + "/replay").c_str()))
+    {
+        this->replay->load(payload, length);
+        free(payload_s);
+        return;
+    }
+
+    if (this->replay != nullptr && !strcmp(topic, String(this->getCombinedRootTopic() + "/replay/generate").c_str()))
+    {
+        this->startReplayGenerator(payload_s);
+        free(payload_s);
+        return;
+    }
+
+    if (this->replay != nullptr && !strcmp(topic, String(this->getCombinedRootTopic() + "/replay/rate").c_str()))
+    {
+        this->replay->setRate(strtoul(payload_s, nullptr, 10));
+        free(payload_s);
+        return;
+    }
+
+    if (this->devices != nullptr && !strcmp(topic, String(this->getCombinedRootTopic() + "/config/set").c_str()))
+    {
+        this->changeDevices(payload_s);
+        free(payload_s);
+        return;
+    }
+
+    String claimTopic = this->mqttRootTopic + "/cluster/claim/";
+    if (this->cluster != nullptr && !strncmp(topic, claimTopic.c_str(), claimTopic.length()))
+    {
+        ClusterClaim claim;
+        if (Cluster::parseClaim(payload_s, &claim))
+            this->cluster->handleClaim(topic + claimTopic.length(), claim);
+        free(payload_s);
+        return;
+    }
+
+    if (this->learner != nullptr && !strcmp(topic, String(this->getCombinedRootTopic() + "/learn").c_str()))
+    {
+        this->learner->setEnabled(!strcmp(payload_s, "ON"));
+        free(payload_s);
+        return;
+    }
+
+    if (this->learner != nullptr && !strcmp(topic, String(this->getCombinedRootTopic() + "/learn/promote").c_str()))
+    {
+        this->promoteRemote(payload_s);
+        free(payload_s);
+        return;
+    }
+
+    if (this->restoreLightbarState(topic, payload_s))
+    {
+        free(payload_s);
+        return;
+    }
 
     JSONVar command = JSON.parse(payload_s);
     free(payload_s);
@@ -54,6 +146,8 @@ void MQTT::onMessage(char *topic, byte *payload, unsigned int length)
         lightbar = this->lightbars[i];
         if (!strcmp(topic, String(this->getCombinedRootTopic() + "/" + lightbar->getSerialString() + "/pair").c_str()))
         {
+            if (this->transitions != nullptr)
+                this->transitions->cancel(lightbar);
             lightbar->pair();
             return;
         }
@@ -64,15 +158,31 @@ void MQTT::onMessage(char *topic, byte *payload, unsigned int length)
         if (JSON.typeof(command) != "object")
             continue;
 
+        // Every new command replaces a running transition.
+        if (this->transitions != nullptr)
+            this->transitions->cancel(lightbar);
+
         if (command.hasOwnProperty("state"))
         {
             const char *state = command["state"];
-            lightbar->setOnOff(strcmp(state, "ON"));
+            lightbar->setOnOff(!strcmp(state, "ON"));
+        }
+
+        if (this->transitions != nullptr && command.hasOwnProperty("transition") && (double)command["transition"] > 0)
+        {
+            int8_t brightness = -1;
+            if (command.hasOwnProperty("brightness"))
+                brightness = lightbar->scaledBrightnessToBrightness((int)command["brightness"]);
+            int8_t temperature = -1;
+            if (command.hasOwnProperty("color_temp"))
+                temperature = lightbar->miredsToTemperature((uint)command["color_temp"]);
+            if (this->transitions->start(lightbar, brightness, temperature, (unsigned long)((double)command["transition"] * 1000)))
+                continue;
         }
 
         if (command.hasOwnProperty("brightness"))
         {
-            lightbar->setBrightness((uint8_t)command["brightness"]);
+            lightbar->setScaledBrightness((int)command["brightness"]);
         }
 
         if (command.hasOwnProperty("color_temp"))
@@ -84,50 +194,396 @@ void MQTT::onMessage(char *topic, byte *payload, unsigned int length)
 
 void MQTT::setup()
 {
-    Serial.print("[MQTT] Device ID: ");
-    Serial.println(this->clientId);
-    Serial.print("[MQTT] Root Topic: ");
-    Serial.println(this->getCombinedRootTopic());
+    LOG_INFO("[MQTT] Device ID: %s", this->clientId.c_str());
+    LOG_INFO("[MQTT] Root Topic: %s", this->getCombinedRootTopic().c_str());
 
+    // The client keeps pointers to these strings, so they must outlive it.
     this->client->setServer(this->mqttServer, this->mqttPort);
-    this->client->setCallback(std::bind(&MQTT::onMessage, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+    this->client->setClientId(this->clientId.c_str());
+    this->client->setCredentials(this->mqttUser, this->mqttPassword);
+    this->client->setWill(this->availabilityTopic.c_str(), 1, true, "offline");
+
+    // All callbacks run in the context of the TCP stack. They only hand over to loop().
+    this->client->onConnect([this](bool sessionPresent)
+                            { this->connectedEvent = true; });
+    this->client->onDisconnect([this](AsyncMqttClientDisconnectReason reason)
+                               { this->disconnectedEvent = true; });
+    this->client->onMessage([this](char *topic, char *payload, AsyncMqttClientMessageProperties properties, size_t length, size_t index, size_t total)
+                            { this->onClientMessage(topic, payload, length, index, total); });
+    this->client->onPublish([this](uint16_t packetId)
+                            { this->onClientPublish(packetId); });
+
+    this->connect();
+}
+
+void MQTT::connect()
+{
+    this->connectRetries++;
+    if (this->connectRetries > 60)
+        ESP.restart();
+
+    LOG_INFO("[MQTT] Connecting to MQTT broker...");
+    this->connecting = true;
+    this->lastConnectAttempt = millis();
+    this->client->connect();
+}
+
+void MQTT::onConnected()
+{
+    LOG_INFO("[MQTT] connected!");
+    this->connecting = false;
+    this->connectRetries = 0;
+
+    this->publish(this->availabilityTopic, "online", 1, true);
+    this->client->subscribe(String(this->getCombinedRootTopic() + "/+/command").c_str(), 1);
+    this->client->subscribe(String(this->getCombinedRootTopic() + "/+/pair").c_str(), 1);
+    // The retained states tell what Home Assistant last knew, which is better than anything assumed.
+    this->client->subscribe(String(this->getCombinedRootTopic() + "/+/light_state").c_str(), 1);
+    if (this->capture != nullptr)
+        this->client->subscribe(String(this->getCombinedRootTopic() + "/capture").c_str(), 1);
+    this->client->subscribe(String(this->getCombinedRootTopic() + "/debug").c_str(), 1);
+    if (this->replay != nullptr)
+    {
+        this->client->subscribe(String(this->getCombinedRootTopic() + "/replay").c_str(), 1);
+        this->client->subscribe(String(this->getCombinedRootTopic() + "/replay/generate").c_str(), 1);
+        this->client->subscribe(String(this->getCombinedRootTopic() + "/replay/rate").c_str(), 1);
+    }
+    if (this->learner != nullptr)
+    {
+        this->client->subscribe(String(this->getCombinedRootTopic() + "/learn").c_str(), 1);
+        this->client->subscribe(String(this->getCombinedRootTopic() + "/learn/promote").c_str(), 1);
+    }
+    if (this->devices != nullptr)
+        this->client->subscribe(String(this->getCombinedRootTopic() + "/config/set").c_str(), 1);
+    this->client->subscribe(String(this->getCombinedRootTopic() + "/+/raw").c_str(), 0);
+    // Claims are shared by all controllers, so they live below the common root topic.
+    if (this->cluster != nullptr)
+        this->client->subscribe(String(this->mqttRootTopic + "/cluster/claim/+").c_str(), 0);
+
+    this->sendAllHomeAssistantDiscoveryMessages();
+    this->sendDevices();
+    // Report how long it took to get back online right away, not only with the next periodic statistics.
+    this->sendNetworkStats();
+
+    // Make sure the retained states are up to date, in case they changed while being disconnected.
+    for (int i = 0; i < this->lightbarCount; i++)
+    {
+        this->publishedStateValid[i] = false;
+    }
+}
+
+void MQTT::onClientMessage(char *topic, char *payload, size_t length, size_t index, size_t total)
+{
+    if (this->onClientRawCommand(topic, payload, length, index, total))
+        return;
 
-    uint retries = 0;
-    Serial.println("[MQTT] Connecting to MQTT broker...");
-    while (!this->client->connected())
+    // Large payloads arrive in multiple chunks. Collect them until the message is complete.
+    if (index == 0)
     {
-        if (!this->client->connect(this->clientId.c_str(), this->mqttUser, this->mqttPassword, String(this->getCombinedRootTopic() + "/availability").c_str(), 1, true, "offline"))
+        if (this->inboundPartial != nullptr)
+        {
+            free(this->inboundPartial->topic);
+            free(this->inboundPartial->payload);
+            this->inboundPartial = nullptr;
+        }
+        if (this->inboundCount >= constants::MQTT_INBOUND_QUEUE_SIZE)
+        {
+            this->stats.inboundDropped++;
+            return;
+        }
+
+        InboundMessage *message = &this->inbound[(this->inboundHead + this->inboundCount) % constants::MQTT_INBOUND_QUEUE_SIZE];
+        message->topic = strdup(topic);
+        message->payload = (byte *)malloc(max(total, (size_t)1));
+        message->length = total;
+        message->received = 0;
+        if (message->topic == nullptr || message->payload == nullptr)
         {
-            Serial.print("[MQTT] Connection failed! rc=");
-            Serial.print(this->client->state());
-            Serial.println(" trying again in 1 second.");
-            delay(1000);
-            retries++;
-            if (retries > 60)
-                ESP.restart();
+            free(message->topic);
+            free(message->payload);
+            this->stats.inboundDropped++;
+            return;
         }
+        this->inboundPartial = message;
     }
 
-    Serial.println("[MQTT] connected!");
-    this->client->publish(String(this->getCombinedRootTopic() + "/availability").c_str(), "online", true);
-    this->client->subscribe(String(this->getCombinedRootTopic() + "/+/command").c_str());
-    this->client->subscribe(String(this->getCombinedRootTopic() + "/+/pair").c_str());
+    if (this->inboundPartial == nullptr || index + length > this->inboundPartial->length)
+        return;
 
-    this->sendAllHomeAssistantDiscoveryMessages();
+    memcpy(this->inboundPartial->payload + index, payload, length);
+    this->inboundPartial->received += length;
+    if (this->inboundPartial->received >= this->inboundPartial->length)
+    {
+        this->inboundCount++;
+        this->inboundPartial = nullptr;
+    }
+}
+
+bool MQTT::onClientRawCommand(char *topic, char *payload, size_t length, size_t index, size_t total)
+{
+    // Binary commands are meant for high rates. They are decoded right here, without any allocation.
+    size_t rootLength = this->combinedRootTopic.length();
+    if (strncmp(topic, this->combinedRootTopic.c_str(), rootLength) || topic[rootLength] != '/')
+        return false;
+    char *end;
+    uint32_t serial = strtoul(topic + rootLength + 1, &end, 16);
+    if (strcmp(end, "/raw"))
+        return false;
+
+    RawCommand command;
+    if (index != 0 || length != total || !command.decode((const byte *)payload, length))
+    {
+        this->stats.rawRejected++;
+        return true;
+    }
+    command.serial = serial;
+
+    // If the previous command for this light bar is still waiting, only the latest values matter.
+    for (int i = 0; i < this->rawCommandCount; i++)
+    {
+        RawCommand *queued = &this->rawCommands[(this->rawCommandHead + i) % constants::MQTT_RAW_COMMAND_QUEUE_SIZE];
+        if (queued->serial == serial && !(queued->flags & RawCommand::FLAG_COMMAND))
+        {
+            queued->merge(&command);
+            return true;
+        }
+    }
+
+    if (this->rawCommandCount >= constants::MQTT_RAW_COMMAND_QUEUE_SIZE)
+    {
+        this->stats.inboundDropped++;
+        return true;
+    }
+    this->rawCommands[(this->rawCommandHead + this->rawCommandCount) % constants::MQTT_RAW_COMMAND_QUEUE_SIZE] = command;
+    this->rawCommandCount++;
+    return true;
+}
+
+void MQTT::onClientPublish(uint16_t packetId)
+{
+    for (int i = 0; i < this->outboundCount; i++)
+    {
+        OutboundMessage *message = &this->outbound[(this->outboundHead + i) % constants::MQTT_OUTBOUND_QUEUE_SIZE];
+        if (message->state == OutboundMessage::State::IN_FLIGHT && message->packetId == packetId)
+        {
+            message->state = OutboundMessage::State::DONE;
+            this->inFlight--;
+            this->stats.acknowledged++;
+            return;
+        }
+    }
+}
+
+bool MQTT::publish(const String &topic, const char *payload, size_t length, uint8_t qos, bool retain)
+{
+    if (this->outboundCount >= constants::MQTT_OUTBOUND_QUEUE_SIZE ||
+        this->outboundBytes + length > constants::MQTT_OUTBOUND_QUEUE_BYTES)
+    {
+        this->stats.dropped++;
+        return false;
+    }
+
+    char *copy = nullptr;
+    if (length > 0)
+    {
+        copy = (char *)malloc(length);
+        if (copy == nullptr)
+        {
+            this->stats.dropped++;
+            return false;
+        }
+        memcpy(copy, payload, length);
+    }
+
+    OutboundMessage *message = &this->outbound[(this->outboundHead + this->outboundCount) % constants::MQTT_OUTBOUND_QUEUE_SIZE];
+    message->topic = topic;
+    message->payload = copy;
+    message->length = length;
+    message->qos = qos;
+    message->retain = retain;
+    message->state = OutboundMessage::State::QUEUED;
+    message->packetId = 0;
+    this->outboundCount++;
+    this->outboundBytes += length;
+
+    this->stats.queued++;
+    this->stats.maxQueueLength = max(this->stats.maxQueueLength, (uint16_t)this->outboundCount);
+    return true;
+}
+
+bool MQTT::publish(const String &topic, const String &payload, uint8_t qos, bool retain)
+{
+    return this->publish(topic, payload.c_str(), payload.length(), qos, retain);
+}
+
+const MQTTStats *MQTT::getStats()
+{
+    return &this->stats;
+}
+
+uint8_t MQTT::getOutboundFree()
+{
+    return constants::MQTT_OUTBOUND_QUEUE_SIZE - this->outboundCount;
+}
+
+void MQTT::processOutbound()
+{
+    PROFILE_SCOPE("mqtt.publish");
+    if (this->client->connected())
+    {
+        for (int i = 0; i < this->outboundCount; i++)
+        {
+            OutboundMessage *message = &this->outbound[(this->outboundHead + i) % constants::MQTT_OUTBOUND_QUEUE_SIZE];
+            if (message->state != OutboundMessage::State::QUEUED)
+                continue;
+            // Keep the order of messages: nothing overtakes a message waiting for the in-flight window.
+            if (message->qos > 0 && this->inFlight >= constants::MQTT_IN_FLIGHT_WINDOW)
+                break;
+
+            bool retransmission = message->packetId != 0;
+            uint16_t packetId = this->client->publish(message->topic.c_str(), message->qos, message->retain, message->payload, message->length, retransmission, message->packetId);
+            if (packetId == 0)
+            {
+                // The TCP send buffer is full. Try again in the next loop.
+                this->stats.backpressure++;
+                break;
+            }
+
+            this->stats.published++;
+            if (retransmission)
+                this->stats.retransmitted++;
+
+            if (message->qos == 0)
+            {
+                message->state = OutboundMessage::State::DONE;
+                continue;
+            }
+            message->packetId = packetId;
+            message->state = OutboundMessage::State::IN_FLIGHT;
+            this->inFlight++;
+            this->stats.maxInFlight = max(this->stats.maxInFlight, (uint16_t)this->inFlight);
+        }
+    }
+
+    while (this->outboundCount > 0 && this->outbound[this->outboundHead].state == OutboundMessage::State::DONE)
+    {
+        OutboundMessage *message = &this->outbound[this->outboundHead];
+        free(message->payload);
+        message->payload = nullptr;
+        message->topic = String();
+        this->outboundBytes -= message->length;
+        this->outboundHead = (this->outboundHead + 1) % constants::MQTT_OUTBOUND_QUEUE_SIZE;
+        this->outboundCount--;
+    }
+}
+
+void MQTT::processRawCommands()
+{
+    // Like other messages, handle only one command per loop.
+    if (this->rawCommandCount == 0)
+        return;
+
+    PROFILE_SCOPE("mqtt.raw");
+    RawCommand command = this->rawCommands[this->rawCommandHead];
+    this->rawCommandHead = (this->rawCommandHead + 1) % constants::MQTT_RAW_COMMAND_QUEUE_SIZE;
+    this->rawCommandCount--;
+
+    Lightbar *lightbar = nullptr;
+    for (int i = 0; i < this->lightbarCount; i++)
+    {
+        if (this->lightbars[i]->getSerial() == command.serial)
+        {
+            lightbar = this->lightbars[i];
+            break;
+        }
+    }
+    if (lightbar == nullptr)
+    {
+        this->stats.rawRejected++;
+        return;
+    }
+
+    if (this->transitions != nullptr)
+        this->transitions->cancel(lightbar);
+    if (command.flags & RawCommand::FLAG_STATE)
+        lightbar->setOnOff(command.flags & RawCommand::FLAG_ON);
+    if (command.flags & RawCommand::FLAG_BRIGHTNESS)
+        lightbar->setBrightness(min(command.brightness, Lightbar::MAX_STEP));
+    if (command.flags & RawCommand::FLAG_TEMPERATURE)
+        lightbar->setTemperature(min(command.temperature, Lightbar::MAX_STEP));
+    if (command.flags & RawCommand::FLAG_COMMAND)
+        lightbar->sendRawCommand((Lightbar::Command)command.command, command.options);
+}
+
+void MQTT::processInbound()
+{
+    // Handle only one message per loop, so the radio is not starved by a burst of commands.
+    if (this->inboundCount == 0)
+        return;
+
+    InboundMessage *message = &this->inbound[this->inboundHead];
+    this->onMessage(message->topic, message->payload, message->length);
+    free(message->topic);
+    free(message->payload);
+    this->inboundHead = (this->inboundHead + 1) % constants::MQTT_INBOUND_QUEUE_SIZE;
+    this->inboundCount--;
+}
+
+void MQTT::setCapture(Capture *capture)
+{
+    this->capture = capture;
+}
+
+void MQTT::setTransitions(Transitions *transitions)
+{
+    this->transitions = transitions;
+}
+
+void MQTT::setRadio(Radio *radio)
+{
+    this->radio = radio;
+}
+
+void MQTT::setNetwork(Network *network)
+{
+    this->network = network;
+}
+
+void MQTT::setLearner(RemoteLearner *learner)
+{
+    this->learner = learner;
+}
+
+void MQTT::setReplay(Replay *replay)
+{
+    this->replay = replay;
+}
+
+void MQTT::setDevices(Devices *devices)
+{
+    this->devices = devices;
+}
+
+void MQTT::setCluster(Cluster *cluster)
+{
+    this->cluster = cluster;
+    this->cluster->setClientId(this->clientId);
 }
 
 bool MQTT::addLightbar(Lightbar *lightbar)
 {
     if (this->lightbarCount >= constants::MAX_LIGHTBARS)
     {
-        Serial.println("[MQTT] Could not add light bar, because too many light bars are saved!");
-        Serial.println("[MQTT] Please check if you actually want to save more than " + String(constants::MAX_LIGHTBARS, DEC) + " light bars.");
-        Serial.println("[MQTT] If you do, increase MAX_LIGHTBARS in constants.h and recompile.");
+        LOG_ERROR("[MQTT] Could not add light bar, because too many light bars are saved!");
+        LOG_ERROR("[MQTT] Please check if you actually want to save more than %u light bars.", constants::MAX_LIGHTBARS);
+        LOG_ERROR("[MQTT] If you do, increase MAX_LIGHTBARS in constants.h and recompile.");
         return false;
     }
     this->lightbars[this->lightbarCount] = lightbar;
+    this->lightbarDiscoveryPending[this->lightbarCount] = this->homeAssistantDiscovery;
+    this->publishedStateValid[this->lightbarCount] = false;
+    this->stateChangePendingSince[this->lightbarCount] = 0;
     this->lightbarCount++;
-    this->sendHomeAssistantLightbarDiscoveryMessages(lightbar);
     return true;
 }
 
@@ -137,9 +593,17 @@ bool MQTT::removeLightbar(Lightbar *lightbar)
     {
         if (this->lightbars[i] == lightbar)
         {
+            if (this->transitions != nullptr)
+                this->transitions->cancel(lightbar);
+            this->clearHomeAssistantLightbarDiscoveryMessages(lightbar);
+            this->publish(this->getCombinedRootTopic() + "/" + lightbar->getSerialString() + "/light_state", nullptr, 0, 1, true);
             for (int j = i; j < this->lightbarCount - 1; j++)
             {
                 this->lightbars[j] = this->lightbars[j + 1];
+                this->lightbarDiscoveryPending[j] = this->lightbarDiscoveryPending[j + 1];
+                this->publishedStates[j] = this->publishedStates[j + 1];
+                this->publishedStateValid[j] = this->publishedStateValid[j + 1];
+                this->stateChangePendingSince[j] = this->stateChangePendingSince[j + 1];
             }
             this->lightbarCount--;
             return true;
@@ -152,15 +616,16 @@ bool MQTT::addRemote(Remote *remote)
 {
     if (this->remoteCount >= constants::MAX_REMOTES)
     {
-        Serial.println("[MQTT] Could not add remote, because too many remotes are saved!");
-        Serial.println("[MQTT] Please check if you actually want to save more than " + String(constants::MAX_REMOTES, DEC) + " remotes.");
-        Serial.println("[MQTT] If you do, increase MAX_REMOTES in constants.h and recompile.");
+        LOG_ERROR("[MQTT] Could not add remote, because too many remotes are saved!");
+        LOG_ERROR("[MQTT] Please check if you actually want to save more than %u remotes.", constants::MAX_REMOTES);
+        LOG_ERROR("[MQTT] If you do, increase MAX_REMOTES in constants.h and recompile.");
         return false;
     }
     this->remotes[this->remoteCount] = remote;
+    this->remoteDiscoveryPending[this->remoteCount] = this->homeAssistantDiscovery;
+    this->actionClearTimes[this->remoteCount] = 0;
     this->remoteCount++;
-    remote->registerCommandListener(this->remoteCommandHandler);
-    this->sendHomeAssistantRemoteDiscoveryMessages(remote);
+    remote->registerCommandListener(this->remoteCommandHandler, this);
     return true;
 }
 
@@ -170,10 +635,16 @@ bool MQTT::removeRemote(Remote *remote)
     {
         if (this->remotes[i] == remote)
         {
-            this->remotes[i]->registerCommandListener(this->remoteCommandHandler);
+            remote->unregisterCommandListeners(this);
+            this->gestureAggregator->flush(remote);
+            if (this->cluster != nullptr)
+                this->cluster->cancel(remote);
+            this->clearHomeAssistantRemoteDiscoveryMessages(remote);
             for (int j = i; j < this->remoteCount - 1; j++)
             {
                 this->remotes[j] = this->remotes[j + 1];
+                this->remoteDiscoveryPending[j] = this->remoteDiscoveryPending[j + 1];
+                this->actionClearTimes[j] = this->actionClearTimes[j + 1];
             }
             this->remoteCount--;
             return true;
@@ -182,193 +653,869 @@ bool MQTT::removeRemote(Remote *remote)
     return false;
 }
 
-void MQTT::sendAllHomeAssistantDiscoveryMessages()
+void MQTT::promoteRemote(const char *payload)
 {
-    if (!this->homeAssistantDiscovery)
+    if (this->devices == nullptr)
         return;
-    for (int i = 0; i < this->lightbarCount; i++)
+
+    // The payload is either just the serial or an object with the serial and a name.
+    uint32_t serial;
+    String name;
+    JSONVar request = JSON.parse(payload);
+    bool valid;
+    if (JSON.typeof(request) == "object" && request.hasOwnProperty("serial"))
     {
-        this->sendHomeAssistantLightbarDiscoveryMessages(this->lightbars[i]);
-        yield();
+        valid = JSON.typeof(request["serial"]) == "string" && MQTT::parseSerial(request["serial"], &serial);
+        if (request.hasOwnProperty("name"))
+        {
+            valid = valid && JSON.typeof(request["name"]) == "string";
+            if (valid)
+                name = (const char *)request["name"];
+        }
     }
-    for (int i = 0; i < this->remoteCount; i++)
+    else
     {
-        this->sendHomeAssistantRemoteDiscoveryMessages(this->remotes[i]);
-        yield();
+        valid = MQTT::parseSerial(payload, &serial);
+    }
+    if (!valid)
+    {
+        LOG_WARNING("[MQTT] Ignoring invalid promotion: %s", payload);
+        return;
+    }
+
+    if (this->learner->findCandidate(serial) == nullptr)
+    {
+        LOG_WARNING("[MQTT] Not promoting 0x%06X, because it was not learned!", serial);
+        return;
+    }
+    if (this->devices->findRemote(serial) != nullptr)
+    {
+        this->learner->remove(serial);
+        return;
     }
+
+    if (name.length() == 0)
+        name = "Remote 0x" + String(serial, HEX);
+    Remote *remote = this->devices->addRemote(serial, name.c_str());
+    if (remote == nullptr)
+        return;
+
+    this->learner->remove(serial);
+    this->sendDevices();
+    LOG_INFO("[MQTT] Remote %s promoted!", remote->getSerialString().c_str());
 }
 
-void MQTT::sendHomeAssistantLightbarDiscoveryMessages(Lightbar *lightbar)
+void MQTT::changeDevices(const char *payload)
 {
-    if (!this->homeAssistantDiscovery)
+    JSONVar request = JSON.parse(payload);
+    uint32_t serial;
+    if (JSON.typeof(request) != "object" || JSON.typeof(request["action"]) != "string" || JSON.typeof(request["type"]) != "string" ||
+        JSON.typeof(request["serial"]) != "string" || !MQTT::parseSerial(request["serial"], &serial) ||
+        (request.hasOwnProperty("name") && JSON.typeof(request["name"]) != "string"))
+    {
+        LOG_WARNING("[MQTT] Ignoring invalid device change: %s", payload);
         return;
+    }
 
-    Serial.print("[MQTT] Sending lightbar discovery messages for ");
-    Serial.println(lightbar->getSerialString());
-
-    const String topicClient = this->clientId + "_" + lightbar->getSerialString();
-    const String baseConfig = R"json(
-    "schema": "json",
-    "o": {
-        "name": "lightbar2mqtt",
-        "sw_version": ")json" +
-                              constants::VERSION +
-                              R"json(",
-        "support_url": "https://github.com/ebinf/lightbar2mqtt"
-    },
-    "~": ")json" + this->getCombinedRootTopic() +
-                              "/" +
-                              lightbar->getSerialString() +
-                              R"json(",
-    "availability_topic": ")json" +
-                              this->getCombinedRootTopic() + R"json(/availability",
-    "dev":
-    {
-        "ids" : ")json" + topicClient +
-                              R"json(",
-        "name": ")json" +
-                              lightbar->getName() +
-                              R"json(",
-        "mdl": "Mi Computer Monitor Light Bar (MJGJD01YL)",
-        "mf": "Xiaomi",
-        "sw": "lightbar2mqtt )json" +
-                              constants::VERSION +
-                              R"json(",
-        "sn": ")json" +
-                              lightbar->getSerialString() +
-                              R"json("
-    },)json";
-
-    String rendevous_str = "{" +
-                           baseConfig +
-                           R"json(
-    "supported_color_modes": [
-        "color_temp"
-    ],
-    "brightness": true,
-    "brightness_scale": 15,
-    "name": "Light bar",
-    "cmd_t": "~/command",
-    "uniq_id": ")json" + topicClient +
-                           R"json(_lightbar",
-    "max_mireds": 370,
-    "min_mireds":153,
-    "icon": "mdi:wall-sconce-flat"
-    )json" + "}";
+    const char *action = request["action"];
+    const char *type = request["type"];
+    bool lightbar = !strcmp(type, "lightbar");
+    if (!lightbar && strcmp(type, "remote"))
+    {
+        LOG_WARNING("[MQTT] Ignoring device change of unknown type %s", type);
+        return;
+    }
 
-    this->client->beginPublish(String(homeAssistantDiscoveryPrefix + "/light/" + topicClient + "/config").c_str(), rendevous_str.length(), true);
-    this->client->print(rendevous_str);
-    this->client->endPublish();
+    bool changed = false;
+    if (!strcmp(action, "add"))
+    {
+        String name;
+        if (request.hasOwnProperty("name"))
+            name = (const char *)request["name"];
+        if (name.length() == 0)
+            name = String(lightbar ? "Light bar 0x" : "Remote 0x") + String(serial, HEX);
+        if (lightbar)
+            changed = this->devices->addLightbar(serial, name.c_str()) != nullptr;
+        else
+            changed = this->devices->addRemote(serial, name.c_str()) != nullptr;
+    }
+    else if (!strcmp(action, "remove"))
+    {
+        if (lightbar)
+            changed = this->devices->removeLightbar(serial);
+        else
+            changed = this->devices->removeRemote(serial);
+    }
+    else
+    {
+        LOG_WARNING("[MQTT] Ignoring unknown device change %s", action);
+        return;
+    }
 
-    rendevous_str = "{" +
-                    baseConfig +
-                    R"json(
-    "name": "Pair",
-    "cmd_t": "~/pair",
-    "uniq_id": ")json" +
-                    topicClient + R"json(_pair"
-    )json" + "}";
-    this->client->beginPublish(String(homeAssistantDiscoveryPrefix + "/button/" + topicClient + "/config").c_str(), rendevous_str.length(), true);
-    this->client->print(rendevous_str);
-    this->client->endPublish();
+    if (!changed)
+        LOG_WARNING("[MQTT] Could not %s %s 0x%06X", action, type, serial);
+    this->sendDevices();
 }
 
-void MQTT::sendHomeAssistantRemoteDiscoveryMessages(Remote *remote)
+void MQTT::sendDevices()
 {
-    if (!this->homeAssistantDiscovery)
+    if (this->devices == nullptr)
         return;
 
-    Serial.print("[MQTT] Sending remote discovery messages for ");
-    Serial.println(remote->getSerialString());
-
-    const String topicClient = this->clientId + "_" + remote->getSerialString();
-    const String baseConfig = R"json(
-    "schema": "json",
+    // Names are free text, JSON.stringify() quotes and escapes them.
+    String payload = R"json({"lightbars":[)json";
+    for (int i = 0; i < this->devices->getNumLightbars(); i++)
+    {
+        Lightbar *lightbar = this->devices->getLightbar(i);
+        if (i > 0)
+            payload += ",";
+        payload += String(R"json({"serial":")json") + lightbar->getSerialString() +
+                   R"json(","name":)json" + JSON.stringify(JSONVar(lightbar->getName())) + "}";
+    }
+    payload += R"json(],"remotes":[)json";
+    for (int i = 0; i < this->devices->getNumRemotes(); i++)
+    {
+        Remote *remote = this->devices->getRemote(i);
+        if (i > 0)
+            payload += ",";
+        payload += String(R"json({"serial":")json") + remote->getSerialString() +
+                   R"json(","name":)json" + JSON.stringify(JSONVar(remote->getName())) + "}";
+    }
+    payload += "]}";
+    this->publish(this->getCombinedRootTopic() + "/config", payload, 1, true);
+}
+
+void MQTT::startReplayGenerator(const char *payload)
+{
+    JSONVar request = JSON.parse(payload);
+    uint32_t serial = 0;
+    if (JSON.typeof(request) != "object" || JSON.typeof(request["type"]) != "string" ||
+        (request.hasOwnProperty("serial") && (JSON.typeof(request["serial"]) != "string" || !MQTT::parseSerial(request["serial"], &serial))))
+    {
+        LOG_WARNING("[MQTT] Ignoring invalid replay generator: %s", payload);
+        return;
+    }
+
+    const char *type = request["type"];
+    Replay::Generator generator = Replay::Generator::NONE;
+    if (!strcmp(type, "noise"))
+        generator = Replay::Generator::NOISE;
+    else if (!strcmp(type, "bad_crc"))
+        generator = Replay::Generator::BAD_CRC;
+    else if (!strcmp(type, "burst"))
+        generator = Replay::Generator::BURST;
+    else if (!strcmp(type, "wraparound"))
+        generator = Replay::Generator::WRAPAROUND;
+
+    uint16_t count = request.hasOwnProperty("count") ? (int)request["count"] : 100;
+    uint8_t repeats = request.hasOwnProperty("repeats") ? (int)request["repeats"] : 5;
+    uint8_t sequence = request.hasOwnProperty("sequence") ? (int)request["sequence"] : 1;
+    if (request.hasOwnProperty("rate"))
+        this->replay->setRate((int)request["rate"]);
+
+    if (!this->replay->generate(generator, serial, count, repeats, sequence))
+        LOG_WARNING("[MQTT] Ignoring invalid replay generator!");
+}
+
+bool MQTT::parseSerial(const char *text, uint32_t *serial)
+{
+    // Serials are 24 bits wide, and 0 is never a real device.
+    char *end;
+    unsigned long value = strtoul(text, &end, 16);
+    if (end == text || *end != '\0' || value == 0 || value > 0xFFFFFF)
+        return false;
+    *serial = value;
+    return true;
+}
+
+const String MQTT::getResultsJson(const uint32_t *results)
+{
+    return String(R"json({"wrong_preamble":)json") + String(results[Capture::Result::WRONG_PREAMBLE]) +
+           R"json(,"wrong_checksum":)json" + String(results[Capture::Result::WRONG_CHECKSUM]) +
+           R"json(,"unknown_serial":)json" + String(results[Capture::Result::UNKNOWN_SERIAL]) +
+           R"json(,"duplicate":)json" + String(results[Capture::Result::DUPLICATE]) +
+           R"json(,"accepted":)json" + String(results[Capture::Result::ACCEPTED]) + "}";
+}
+
+void MQTT::sendReplayReport()
+{
+    if (this->replay == nullptr || !this->replay->isReportReady())
+        return;
+
+    const ReplayStats *stats = this->replay->getStats();
+    unsigned long duration = stats->lastFrame - stats->firstFrame;
+    double framesPerSecond = stats->frames > 1 && duration > 0 ? (stats->frames - 1) * 1000000.0 / duration : 0;
+    uint32_t accepted = stats->results[Capture::Result::ACCEPTED];
+    // Every expected event has to be accepted exactly once and make it to the controller side.
+    bool dedupCorrect = accepted == stats->expectedEvents && stats->events == accepted;
+
+    String payload = String(R"json({"frames":)json") + String(stats->frames) +
+                     R"json(,"queued":)json" + String(stats->queued) +
+                     R"json(,"dropped":)json" + String(stats->dropped) +
+                     R"json(,"duration":)json" + String(duration) +
+                     R"json(,"frames_per_second":)json" + String(framesPerSecond, 1) +
+                     R"json(,"results":)json" + this->getResultsJson(stats->results) +
+                     R"json(,"expected_events":)json" + String(stats->expectedEvents) +
+                     R"json(,"events":)json" + String(stats->events) +
+                     R"json(,"dedup_correct":)json" + (dedupCorrect ? "true" : "false") + "}";
+    if (this->publish(this->getCombinedRootTopic() + "/replay/report", payload, 1, false))
+        this->replay->clearReport();
+}
+
+void MQTT::sendLearnCandidates()
+{
+    if (this->learner == nullptr || !this->learner->hasChanged() ||
+        millis() - this->lastLearnPublish < constants::LEARN_PUBLISH_INTERVAL_MS)
+        return;
+
+    unsigned long now = millis();
+    String payload = String(R"json({"enabled":)json") + (this->learner->isEnabled() ? "true" : "false") +
+                     R"json(,"evictions":)json" + String(this->learner->getEvictions()) +
+                     R"json(,"candidates":[)json";
+    for (int i = 0; i < this->learner->getNumCandidates(); i++)
+    {
+        const Candidate *candidate = this->learner->getCandidate(i);
+        if (i > 0)
+            payload += ",";
+        payload += String(R"json({"serial":"0x)json") + String(candidate->serial, HEX) +
+                   R"json(","frames":)json" + String(candidate->frames) +
+                   R"json(,"events":)json" + String(candidate->events) +
+                   R"json(,"first_seen":)json" + String(now - candidate->firstSeen) +
+                   R"json(,"last_seen":)json" + String(now - candidate->lastSeen) + "}";
+    }
+    payload += "]}";
+
+    if (this->publish(this->getCombinedRootTopic() + "/learn/candidates", payload, 1, false))
+    {
+        this->learner->clearChanged();
+        this->lastLearnPublish = now;
+    }
+}
+
+void MQTT::sendAllHomeAssistantDiscoveryMessages()
+{
+    if (!this->homeAssistantDiscovery)
+        return;
+    for (int i = 0; i < this->lightbarCount; i++)
+    {
+        this->lightbarDiscoveryPending[i] = true;
+    }
+    for (int i = 0; i < this->remoteCount; i++)
+    {
+        this->remoteDiscoveryPending[i] = true;
+    }
+}
+
+void MQTT::sendPendingHomeAssistantDiscoveryMessages()
+{
+    // Discovery messages are large. Only queue the ones of one device at a time and only if there is enough
+    // room left for actions and state updates.
+    if (!this->client->connected() ||
+        this->getOutboundFree() < constants::MQTT_DISCOVERY_QUEUE_RESERVE ||
+        this->outboundBytes > constants::MQTT_OUTBOUND_QUEUE_BYTES / 2)
+        return;
+
+    PROFILE_SCOPE("mqtt.discovery");
+    for (int i = 0; i < this->lightbarCount; i++)
+    {
+        if (!this->lightbarDiscoveryPending[i])
+            continue;
+        this->lightbarDiscoveryPending[i] = false;
+        this->sendHomeAssistantLightbarDiscoveryMessages(this->lightbars[i]);
+        return;
+    }
+    for (int i = 0; i < this->remoteCount; i++)
+    {
+        if (!this->remoteDiscoveryPending[i])
+            continue;
+        this->remoteDiscoveryPending[i] = false;
+        this->sendHomeAssistantRemoteDiscoveryMessages(this->remotes[i]);
+        return;
+    }
+}
+
+const String MQTT::getHomeAssistantDeviceConfig(const String &ids, const char *name, const char *model, const String &serial)
+{
+    return String(R"json(
     "o": {
         "name": "lightbar2mqtt",
-        "sw_version": ")json" +
-                              constants::VERSION +
-                              R"json(",
+        "sw_version": ")json") +
+           constants::VERSION +
+           R"json(",
         "support_url": "https://github.com/ebinf/lightbar2mqtt"
     },
-    "~": ")json" + this->getCombinedRootTopic() +
-                              "/" +
-                              remote->getSerialString() +
-                              R"json(",
     "availability_topic": ")json" +
-                              this->getCombinedRootTopic() + R"json(/availability",
+           this->availabilityTopic + R"json(",
     "dev": {
-        "ids": ")json" + topicClient +
-                              R"json(",
-        "name": ")json" + remote->getName() +
-                              R"json(",
-        "mdl": "Mi Computer Monitor Light Bar Remote Control (MJGJD01YL)",
+        "ids": ")json" + ids +
+           R"json(",
+        "name": )json" + JSON.stringify(JSONVar(name)) +
+           R"json(,
+        "mdl": ")json" + model +
+           R"json(",
         "mf": "Xiaomi",
         "sw": "lightbar2mqtt )json" +
-                              constants::VERSION +
-                              R"json(",
-        "sn": ")json" + remote->getSerialString() +
-                              R"json("
-    },)json";
-
-    String rendevous_str = "{" +
-                           baseConfig +
-                           R"json(
+           constants::VERSION +
+           R"json(",
+        "sn": ")json" + serial +
+           R"json("
+    })json";
+}
+
+void MQTT::sendHomeAssistantLightbarDiscoveryMessages(Lightbar *lightbar)
+{
+    if (!this->homeAssistantDiscovery)
+        return;
+
+    LOG_INFO("[MQTT] Sending lightbar discovery messages for %s", lightbar->getSerialString().c_str());
+
+    const String topicClient = this->clientId + "_" + lightbar->getSerialString();
+    const String topicBase = R"json(
+    "~": ")json" + this->getCombinedRootTopic() +
+                             "/" + lightbar->getSerialString() + "\",";
+    const String deviceConfig = this->getHomeAssistantDeviceConfig(topicClient, lightbar->getName(), "Mi Computer Monitor Light Bar (MJGJD01YL)", lightbar->getSerialString());
+
+    const String lightConfig = topicBase + R"json(
+    "schema": "json",
+    "supported_color_modes": [
+        "color_temp"
+    ],
+    "brightness": true,
+    "name": "Light bar",
+    "cmd_t": "~/command",
+    "stat_t": "~/light_state",
+    "uniq_id": ")json" + topicClient +
+                               R"json(_lightbar",
+    "transition": true,
+    "max_mireds": )json" + String(lightbar->getMaxMireds()) +
+                               R"json(,
+    "min_mireds": )json" + String(lightbar->getMinMireds()) +
+                               R"json(,
+    "icon": "mdi:wall-sconce-flat"
+    )json";
+
+    const String pairConfig = topicBase + R"json(
+    "name": "Pair",
+    "cmd_t": "~/pair",
+    "uniq_id": ")json" + topicClient +
+                              R"json(_pair"
+    )json";
+
+    if (this->homeAssistantDeviceDiscovery)
+    {
+        String rendevous_str = "{" + deviceConfig + R"json(,
+    "cmps": {
+    "lightbar": {
+    "p": "light",)json" + lightConfig +
+                               R"json(},
+    "pair": {
+    "p": "button",)json" + pairConfig +
+                               "}}}";
+        this->publish(String(homeAssistantDiscoveryPrefix + "/device/" + topicClient + "/config"), rendevous_str, 1, true);
+        return;
+    }
+
+    String rendevous_str = "{" + deviceConfig + "," + lightConfig + "}";
+    this->publish(String(homeAssistantDiscoveryPrefix + "/light/" + topicClient + "/config"), rendevous_str, 1, true);
+
+    rendevous_str = "{" + deviceConfig + "," + pairConfig + "}";
+    this->publish(String(homeAssistantDiscoveryPrefix + "/button/" + topicClient + "/config"), rendevous_str, 1, true);
+}
+
+void MQTT::sendHomeAssistantRemoteDiscoveryMessages(Remote *remote)
+{
+    if (!this->homeAssistantDiscovery)
+        return;
+
+    LOG_INFO("[MQTT] Sending remote discovery messages for %s", remote->getSerialString().c_str());
+
+    const String topicClient = this->clientId + "_" + remote->getSerialString();
+    const String topicBase = R"json(
+    "~": ")json" + this->getCombinedRootTopic() +
+                             "/" + remote->getSerialString() + "\",";
+    const String deviceConfig = this->getHomeAssistantDeviceConfig(topicClient, remote->getName(), "Mi Computer Monitor Light Bar Remote Control (MJGJD01YL)", remote->getSerialString());
+
+    const String sensorConfig = topicBase + R"json(
     "name": "Remote",
     "state_topic": "~/state",
-    "uniq_id": ")json" +
-                           topicClient + R"json(_remote",
+    "uniq_id": ")json" + topicClient +
+                                R"json(_remote",
     "value_template": "{{ value }}",
     "enabled_by_default": true,
     "entity_category": "diagnostic",
     "icon": "mdi:gesture-double-tap"
-    )json" + "}";
-
-    this->client->beginPublish(String(homeAssistantDiscoveryPrefix + "/sensor/" + topicClient + "/remote/config").c_str(), rendevous_str.length(), true);
-    this->client->print(rendevous_str);
-    this->client->endPublish();
-
-    const char *commands[] = {
-        "press",
-        "turn_clockwise",
-        "turn_counterclockwise",
-        "press_turn_clockwise",
-        "press_turn_counterclockwise",
-        "hold"};
-    String cmd;
-    for (int i = 0; i < 6; i++)
-    {
-        cmd = commands[i];
-        rendevous_str = "{" +
-                        baseConfig +
-                        R"json(
+    )json";
+
+    String triggerConfigs[MQTT::NUM_REMOTE_TRIGGERS];
+    for (int i = 0; i < MQTT::NUM_REMOTE_TRIGGERS; i++)
+    {
+        triggerConfigs[i] = topicBase + R"json(
     "automation_type": "trigger",
-    "payload": ")json" + cmd +
-                        R"json(",
-    "subtype": ")json" + cmd +
-                        R"json(",
+    "payload": ")json" + MQTT::remoteTriggers[i] +
+                            R"json(",
+    "subtype": ")json" + MQTT::remoteTriggers[i] +
+                            R"json(",
     "type": "action",
-    "topic": "~/state",
     "topic": "~/state"
-    )json" + "}";
+    )json";
+    }
 
-        this->client->beginPublish(String(homeAssistantDiscoveryPrefix + "/device_automation/" + topicClient + "/" + cmd + "/config").c_str(), rendevous_str.length(), true);
-        this->client->print(rendevous_str);
-        this->client->endPublish();
+    if (this->homeAssistantDeviceDiscovery)
+    {
+        String rendevous_str = "{" + deviceConfig + R"json(,
+    "cmps": {
+    "remote": {
+    "p": "sensor",)json" + sensorConfig +
+                               "}";
+        for (int i = 0; i < MQTT::NUM_REMOTE_TRIGGERS; i++)
+        {
+            rendevous_str += String(",\"") + MQTT::remoteTriggers[i] + R"json(": {
+    "p": "device_automation",)json" + triggerConfigs[i] +
+                             "}";
+        }
+        rendevous_str += "}}";
+        this->publish(String(homeAssistantDiscoveryPrefix + "/device/" + topicClient + "/config"), rendevous_str, 1, true);
+        return;
+    }
+
+    String rendevous_str = "{" + deviceConfig + "," + sensorConfig + "}";
+    this->publish(String(homeAssistantDiscoveryPrefix + "/sensor/" + topicClient + "/remote/config"), rendevous_str, 1, true);
+
+    for (int i = 0; i < MQTT::NUM_REMOTE_TRIGGERS; i++)
+    {
+        rendevous_str = "{" + deviceConfig + "," + triggerConfigs[i] + "}";
+        this->publish(String(homeAssistantDiscoveryPrefix + "/device_automation/" + topicClient + "/" + MQTT::remoteTriggers[i] + "/config"), rendevous_str, 1, true);
+    }
+}
+
+void MQTT::clearHomeAssistantLightbarDiscoveryMessages(Lightbar *lightbar)
+{
+    if (!this->homeAssistantDiscovery)
+        return;
+
+    // An empty retained message removes the entities from Home Assistant.
+    const String topicClient = this->clientId + "_" + lightbar->getSerialString();
+    if (this->homeAssistantDeviceDiscovery)
+    {
+        this->publish(String(homeAssistantDiscoveryPrefix + "/device/" + topicClient + "/config"), nullptr, 0, 1, true);
+        return;
+    }
+    this->publish(String(homeAssistantDiscoveryPrefix + "/light/" + topicClient + "/config"), nullptr, 0, 1, true);
+    this->publish(String(homeAssistantDiscoveryPrefix + "/button/" + topicClient + "/config"), nullptr, 0, 1, true);
+}
+
+void MQTT::clearHomeAssistantRemoteDiscoveryMessages(Remote *remote)
+{
+    if (!this->homeAssistantDiscovery)
+        return;
+
+    const String topicClient = this->clientId + "_" + remote->getSerialString();
+    if (this->homeAssistantDeviceDiscovery)
+    {
+        this->publish(String(homeAssistantDiscoveryPrefix + "/device/" + topicClient + "/config"), nullptr, 0, 1, true);
+        return;
+    }
+    this->publish(String(homeAssistantDiscoveryPrefix + "/sensor/" + topicClient + "/remote/config"), nullptr, 0, 1, true);
+
+    for (int i = 0; i < MQTT::NUM_REMOTE_TRIGGERS; i++)
+    {
+        this->publish(String(homeAssistantDiscoveryPrefix + "/device_automation/" + topicClient + "/" + MQTT::remoteTriggers[i] + "/config"), nullptr, 0, 1, true);
     }
 }
 
 void MQTT::loop()
 {
+    if (this->disconnectedEvent)
+    {
+        this->disconnectedEvent = false;
+        this->connecting = false;
+        LOG_WARNING("[MQTT] connection lost!");
+
+        // Messages without acknowledgement are sent again after reconnecting.
+        for (int i = 0; i < this->outboundCount; i++)
+        {
+            OutboundMessage *message = &this->outbound[(this->outboundHead + i) % constants::MQTT_OUTBOUND_QUEUE_SIZE];
+            if (message->state == OutboundMessage::State::IN_FLIGHT)
+                message->state = OutboundMessage::State::QUEUED;
+        }
+        this->inFlight = 0;
+    }
+
+    if (this->connectedEvent)
+    {
+        this->connectedEvent = false;
+        this->onConnected();
+    }
+
     if (!this->client->connected())
     {
-        Serial.println("[MQTT] connection lost!");
-        this->setup();
+        unsigned long timeout = this->connecting ? constants::MQTT_CONNECT_TIMEOUT_MS : constants::MQTT_RECONNECT_INTERVAL_MS;
+        if (millis() - this->lastConnectAttempt >= timeout)
+        {
+            if (this->connecting)
+                this->client->disconnect(true);
+            this->connect();
+        }
     }
-    this->client->loop();
+
+    this->processInbound();
+    this->processRawCommands();
+    this->gestureAggregator->loop();
+    this->publishClaimedEvents();
+    this->clearActions();
+    this->sendCaptureBatch();
+    this->sendLightbarStates();
+    this->sendLearnCandidates();
+    this->sendReplayReport();
+    this->sendPendingHomeAssistantDiscoveryMessages();
+    this->sendStats();
+    this->sendStalls();
+    this->sendLog();
+    this->processOutbound();
+}
+
+void MQTT::sendCaptureBatch()
+{
+    if (this->capture == nullptr || !this->capture->isBatchReady())
+        return;
+
+    const byte *batch = this->capture->getBatch();
+    uint16_t length = this->capture->getBatchLength();
+    if (this->publish(this->getCombinedRootTopic() + "/capture/data", (const char *)batch, length, 0, false))
+        this->capture->clearBatch();
+}
+
+void MQTT::sendLightbarStates()
+{
+    unsigned long now = millis();
+    for (int i = 0; i < this->lightbarCount; i++)
+    {
+        // Never overwrite the retained state Home Assistant already knows with an assumed one.
+        if (!this->lightbars[i]->isStateKnown())
+            continue;
+
+        const LightbarState *state = this->lightbars[i]->getState();
+        if (this->publishedStateValid[i] && !memcmp(state, &this->publishedStates[i], sizeof(LightbarState)))
+        {
+            this->stateChangePendingSince[i] = 0;
+            continue;
+        }
+
+        // Wait until a burst of changes is over, but not forever if the changes never stop.
+        if (this->stateChangePendingSince[i] == 0)
+            this->stateChangePendingSince[i] = max(now, 1UL);
+        if (now - this->lightbars[i]->getLastStateChange() < constants::STATE_PUBLISH_DEBOUNCE_MS &&
+            now - this->stateChangePendingSince[i] < constants::STATE_PUBLISH_MAX_DELAY_MS)
+            continue;
+
+        this->sendLightbarState(i);
+    }
+}
+
+bool MQTT::restoreLightbarState(const char *topic, const char *payload)
+{
+    for (int i = 0; i < this->lightbarCount; i++)
+    {
+        Lightbar *lightbar = this->lightbars[i];
+        if (strcmp(topic, String(this->getCombinedRootTopic() + "/" + lightbar->getSerialString() + "/light_state").c_str()))
+            continue;
+
+        // Also receives the own states, but those only contain fields that are known already.
+        JSONVar state = JSON.parse(payload);
+        if (JSON.typeof(state) != "object")
+            return true;
+        if (JSON.typeof(state["state"]) == "string")
+            lightbar->restoreOnOff(!strcmp((const char *)state["state"], "ON"));
+        if (JSON.typeof(state["brightness"]) == "number")
+            lightbar->restoreScaledBrightness(constrain((int)state["brightness"], 0, 255));
+        if (JSON.typeof(state["color_temp"]) == "number")
+            lightbar->restoreMiredTemperature((int)state["color_temp"]);
+        return true;
+    }
+    return false;
+}
+
+void MQTT::sendLightbarState(int index)
+{
+    Lightbar *lightbar = this->lightbars[index];
+    const LightbarState *state = lightbar->getState();
+    // Fields that are only assumed are left out, Home Assistant keeps its own value for them.
+    String payload = String(R"json({"state":")json") + (state->on ? "ON" : "OFF") + "\"";
+    if (lightbar->isBrightnessKnown())
+        payload += String(R"json(,"brightness":)json") + String(lightbar->getScaledBrightness());
+    if (lightbar->isTemperatureKnown())
+        payload += String(R"json(,"color_mode":"color_temp","color_temp":)json") + String(lightbar->getMiredTemperature());
+    payload += "}";
+    if (!this->publish(this->getCombinedRootTopic() + "/" + lightbar->getSerialString() + "/light_state", payload, 1, true))
+        return;
+
+    this->publishedStates[index] = *state;
+    this->publishedStateValid[index] = true;
+    this->stateChangePendingSince[index] = 0;
+}
+
+void MQTT::sendLog()
+{
+    if (!this->debugLog || millis() - this->lastLogPublish < constants::LOG_MQTT_INTERVAL_MS)
+        return;
+    this->lastLogPublish = millis();
+
+    char chunk[constants::LOG_MQTT_CHUNK_SIZE];
+    size_t length = logger.read(Logger::Reader::MQTT_READER, chunk, sizeof(chunk));
+    if (length > 0)
+        this->publish(this->getCombinedRootTopic() + "/debug/log", chunk, length, 0, false);
+}
+
+void MQTT::sendStats()
+{
+    if (millis() - this->lastStatsPublish < constants::STATS_INTERVAL_MS)
+        return;
+    this->lastStatsPublish = millis();
+
+    String payload = String(R"json({"queued":)json") + String(this->stats.queued) +
+                     R"json(,"published":)json" + String(this->stats.published) +
+                     R"json(,"acknowledged":)json" + String(this->stats.acknowledged) +
+                     R"json(,"retransmitted":)json" + String(this->stats.retransmitted) +
+                     R"json(,"dropped":)json" + String(this->stats.dropped) +
+                     R"json(,"backpressure":)json" + String(this->stats.backpressure) +
+                     R"json(,"inbound_dropped":)json" + String(this->stats.inboundDropped) +
+                     R"json(,"raw_rejected":)json" + String(this->stats.rawRejected) +
+                     R"json(,"log_dropped":)json" + String(logger.getDropped()) +
+                     R"json(,"queue_length":)json" + String(this->outboundCount) +
+                     R"json(,"queue_bytes":)json" + String(this->outboundBytes) +
+                     R"json(,"max_queue_length":)json" + String(this->stats.maxQueueLength) +
+                     R"json(,"in_flight":)json" + String(this->inFlight) +
+                     R"json(,"max_in_flight":)json" + String(this->stats.maxInFlight) + "}";
+    this->publish(this->getCombinedRootTopic() + "/stats/mqtt", payload, 0, false);
+
+    this->sendProfile();
+    this->sendRadioStats();
+    this->sendNetworkStats();
+    this->sendClusterStats();
+}
+
+void MQTT::sendNetworkStats()
+{
+    if (this->network == nullptr)
+        return;
+
+    const NetworkStats *stats = this->network->getStats();
+    String payload = String(R"json({"last_connect":)json") + String(stats->lastConnectDuration) +
+                     R"json(,"last_connect_fast":)json" + (stats->lastConnectFast ? "true" : "false") +
+                     R"json(,"fast_connects":)json" + String(stats->fastConnects) +
+                     R"json(,"full_connects":)json" + String(stats->fullConnects) +
+                     R"json(,"fast_failures":)json" + String(stats->fastFailures) +
+                     R"json(,"channel":)json" + String(WiFi.channel()) +
+                     R"json(,"rssi":)json" + String(WiFi.RSSI()) + "}";
+    this->publish(this->getCombinedRootTopic() + "/stats/wifi", payload, 0, false);
+}
+
+void MQTT::sendClusterStats()
+{
+    if (this->cluster == nullptr)
+        return;
+
+    const ClusterStats *stats = this->cluster->getStats();
+    String payload = String(R"json({"rank":)json") + String(this->cluster->getRank()) +
+                     R"json(,"claimed":)json" + String(stats->claimed) +
+                     R"json(,"received":)json" + String(stats->received) +
+                     R"json(,"won":)json" + String(stats->won) +
+                     R"json(,"lost":)json" + String(stats->lost) +
+                     R"json(,"overflows":)json" + String(stats->overflows) + "}";
+    this->publish(this->getCombinedRootTopic() + "/stats/cluster", payload, 0, false);
+}
+
+void MQTT::sendRadioStats()
+{
+    if (this->radio == nullptr)
+        return;
+
+    static const char *const priorityNames[Radio::NUM_PRIORITIES] = {"interactive", "normal", "bulk"};
+    String payload = String(R"json({"queue_length":)json") + String(this->radio->getQueueLength()) +
+                     R"json(,"events_dropped":)json" + String(this->radio->getDroppedEvents()) +
+                     R"json(,"requests_dropped":)json" + String(this->radio->getDroppedRequests()) +
+                     R"json(,"received":)json" + this->getResultsJson(this->radio->getReceiveStats()->results);
+    const BurstStats *burst = this->radio->getBurstStats();
+    payload += String(R"json(,"burst":{"bursts":)json") + String(burst->bursts) +
+               R"json(,"packets":)json" + String(burst->packets) +
+               R"json(,"aborted":)json" + String(burst->aborted) +
+               R"json(,"estimated_spi_per_burst":)json" + String(burst->bursts > 0 ? burst->spiTransactions / burst->bursts : 0) +
+               R"json(,"cpu_per_burst":)json" + String(burst->bursts + burst->aborted > 0 ? burst->cpuMicros / (burst->bursts + burst->aborted) : 0) +
+               R"json(,"max_cpu":)json" + String(burst->maxCpuMicros) +
+               R"json(,"packets_per_second":)json" + String(burst->airMicros > 0 ? (uint32_t)((uint64_t)burst->packets * 1000000 / burst->airMicros) : 0) + "}";
+    for (int i = 0; i < Radio::NUM_PRIORITIES; i++)
+    {
+        const TransmitStats *stats = this->radio->getTransmitStats((Radio::Priority)i);
+        payload += String(",\"") + priorityNames[i] +
+                   R"json(":{"sent":)json" + String(stats->sent) +
+                   R"json(,"superseded":)json" + String(stats->superseded) +
+                   R"json(,"dropped":)json" + String(stats->dropped) +
+                   R"json(,"avg_wait":)json" + String(stats->sent > 0 ? stats->totalWait / stats->sent : 0) +
+                   R"json(,"max_wait":)json" + String(stats->maxWait) + "}";
+    }
+    payload += "}";
+    this->publish(this->getCombinedRootTopic() + "/stats/radio", payload, 0, false);
+}
+
+void MQTT::sendProfile()
+{
+    String payload = String(R"json({"iterations":)json") + String(profiler.getIterations()) +
+                     R"json(,"p50":)json" + String(profiler.getPercentile(50)) +
+                     R"json(,"p90":)json" + String(profiler.getPercentile(90)) +
+                     R"json(,"p99":)json" + String(profiler.getPercentile(99)) +
+                     R"json(,"max":)json" + String(profiler.getMaxIteration()) +
+                     R"json(,"stalls":)json" + String(profiler.getNumStalls()) +
+                     R"json(,"sections":{)json";
+    for (int i = 0; i < profiler.getNumSections(); i++)
+    {
+        const ProfileSection *section = profiler.getSection(i);
+        if (i > 0)
+            payload += ",";
+        payload += String("\"") + section->tag +
+                   R"json(":{"count":)json" + String(section->count) +
+                   R"json(,"total":)json" + String(section->totalMicros) +
+                   R"json(,"max":)json" + String(section->maxMicros) + "}";
+    }
+    payload += R"json(},"worst":[)json";
+    for (int i = 0; i < profiler.getNumWorst(); i++)
+    {
+        const ProfileEvent *worst = profiler.getWorst(i);
+        if (i > 0)
+            payload += ",";
+        payload += String(R"json({"section":")json") + worst->tag +
+                   R"json(","duration":)json" + String(worst->micros) +
+                   R"json(,"age":)json" + String(millis() - worst->timestamp) + "}";
+    }
+    payload += "]}";
+
+    // Every report covers the time since the last one.
+    if (this->publish(this->getCombinedRootTopic() + "/stats/loop", payload, 0, false))
+        profiler.reset();
+}
+
+void MQTT::sendStalls()
+{
+    ProfileEvent stall;
+    while (this->getOutboundFree() > constants::MQTT_DISCOVERY_QUEUE_RESERVE && profiler.popStall(&stall))
+    {
+        String payload = String(R"json({"duration":)json") + String(stall.micros) +
+                         R"json(,"section":")json" + (stall.tag != nullptr ? stall.tag : "") +
+                         R"json(","age":)json" + String(millis() - stall.timestamp) + "}";
+        this->publish(this->getCombinedRootTopic() + "/stats/stall", payload, 0, false);
+    }
+}
+
+void MQTT::onRemoteCommand(Remote *remote, byte command, byte options)
+{
+    // Turn events are merged into gestures and sent once the knob stops turning.
+    if (this->gestureAggregator->handle(remote, command, options))
+        return;
+    this->sendAction(remote, command, options);
+}
+
+void MQTT::sendGesture(Gesture *gesture)
+{
+    ClusterEvent event = {gesture->remote, true, *gesture, 0, 0};
+    if (this->claimEvent(gesture->sequence, gesture->lastSequence, gesture->rpd, event))
+        return;
+    this->publishGesture(gesture);
+}
+
+void MQTT::publishGesture(Gesture *gesture)
+{
+    byte command = gesture->command;
+    if (gesture->steps < 0)
+        command = command == Lightbar::Command::BRIGHTER ? Lightbar::Command::DIMMER : Lightbar::Command::WARMER;
+
+    const char *action;
+    switch ((uint8_t)command)
+    {
+    case Lightbar::Command::BRIGHTER:
+        action = "turn_clockwise";
+        break;
+
+    case Lightbar::Command::DIMMER:
+        action = "turn_counterclockwise";
+        break;
+
+    case Lightbar::Command::COOLER:
+        action = "press_turn_clockwise";
+        break;
+
+    default:
+        action = "press_turn_counterclockwise";
+        break;
+    }
+
+    String payload = String(R"json({"action":")json") + action +
+                     R"json(","steps":)json" + String(gesture->steps) +
+                     R"json(,"events":)json" + String(gesture->events) +
+                     R"json(,"duration":)json" + String(gesture->getDuration()) +
+                     R"json(,"velocity":)json" + String(gesture->getVelocity(), 2) + "}";
+
+    String topic = String(this->getCombinedRootTopic() + "/" + gesture->remote->getSerialString() + "/gesture");
+    LOG_DEBUG("[MQTT] Sending message (%s): %s", topic.c_str(), payload.c_str());
+    this->publish(topic, payload, 1, false);
+
+    // Keep the device triggers in Home Assistant working, but only once per gesture.
+    this->publishAction(gesture->remote, command, (byte)min(abs(gesture->steps), 0xFF));
 }
 
 void MQTT::sendAction(Remote *remote, byte command, byte options)
+{
+    ClusterEvent event = {remote, false, {}, command, options};
+    if (this->claimEvent(remote->getLastPackageId(), remote->getLastPackageId(), remote->getLastRpd(), event))
+        return;
+    this->publishAction(remote, command, options);
+}
+
+bool MQTT::claimEvent(uint8_t sequence, uint8_t lastSequence, bool rpd, const ClusterEvent &event)
+{
+    if (this->cluster == nullptr)
+        return false;
+
+    ClusterClaim claim = {event.remote->getSerial(), sequence, rpd, this->cluster->getRank(), lastSequence, event.isGesture};
+    switch (this->cluster->claim(claim, event))
+    {
+    case Cluster::ClaimResult::PENDING:
+    {
+        // Claims are only useful within the claim window, so they skip the outbound queue, where they could wait behind
+        // the in-flight window. A claim that can't be announced is taken back and the event published right away.
+        String topic = this->mqttRootTopic + "/cluster/claim/" + this->clientId;
+        String payload = Cluster::formatClaim(claim);
+        if (!this->client->connected() || this->client->publish(topic.c_str(), 0, false, payload.c_str(), payload.length()) == 0)
+        {
+            this->cluster->withdraw();
+            return false;
+        }
+        this->stats.published++;
+        return true;
+    }
+
+    case Cluster::ClaimResult::LOST:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+void MQTT::publishClaimedEvents()
+{
+    if (this->cluster == nullptr)
+        return;
+
+    ClusterEvent event;
+    while (this->cluster->popWon(&event))
+    {
+        if (event.isGesture)
+            this->publishGesture(&event.gesture);
+        else
+            this->publishAction(event.remote, event.command, event.options);
+    }
+}
+
+void MQTT::publishAction(Remote *remote, byte command, byte options)
 {
     String action;
     switch ((uint8_t)command)
@@ -402,11 +1549,28 @@ void MQTT::sendAction(Remote *remote, byte command, byte options)
     }
 
     String topic = String(this->getCombinedRootTopic() + "/" + remote->getSerialString() + "/state");
-    Serial.print("[MQTT] Sending message (");
-    Serial.print(topic);
-    Serial.print("): ");
-    Serial.println(action);
-    this->client->publish(topic.c_str(), action.c_str());
-    delay(200);
-    this->client->publish(topic.c_str(), NULL);
+    LOG_DEBUG("[MQTT] Sending message (%s): %s", topic.c_str(), action.c_str());
+    this->publish(topic, action, 1, false);
+
+    // Clear the action later from the loop, so neither the radio nor local bindings have to wait for it.
+    for (int i = 0; i < this->remoteCount; i++)
+    {
+        if (this->remotes[i] == remote)
+        {
+            this->actionClearTimes[i] = max(millis() + constants::ACTION_CLEAR_DELAY_MS, 1UL);
+            break;
+        }
+    }
+}
+
+void MQTT::clearActions()
+{
+    unsigned long now = millis();
+    for (int i = 0; i < this->remoteCount; i++)
+    {
+        if (this->actionClearTimes[i] == 0 || (long)(now - this->actionClearTimes[i]) < 0)
+            continue;
+        this->actionClearTimes[i] = 0;
+        this->publish(this->getCombinedRootTopic() + "/" + this->remotes[i]->getSerialString() + "/state", nullptr, 0, 1, false);
+    }
 }
\ No newline at end of file
@@ -1,20 +1,68 @@
-#include <PubSubClient.h>
+#include <AsyncMqttClient.h>
 #include <ESP8266WiFi.h>
 
 #include "constants.h"
 #include "lightbar.h"
 #include "remote.h"
+#include "capture.h"
+#include "gesture.h"
+#include "transition.h"
+#include "raw_command.h"
+#include "network.h"
+#include "learner.h"
+#include "cluster.h"
 
 #ifndef MQTT_H
 #define MQTT_H
 
 class Remote;
 class Lightbar;
+class Devices;
+
+struct OutboundMessage
+{
+    enum State
+    {
+        QUEUED,
+        IN_FLIGHT,
+        DONE
+    };
+
+    String topic;
+    char *payload;
+    size_t length;
+    uint8_t qos;
+    bool retain;
+    State state;
+    uint16_t packetId;
+};
+
+struct InboundMessage
+{
+    char *topic;
+    byte *payload;
+    size_t length;
+    size_t received;
+};
+
+struct MQTTStats
+{
+    uint32_t queued;
+    uint32_t published;
+    uint32_t acknowledged;
+    uint32_t retransmitted;
+    uint32_t dropped;
+    uint32_t backpressure;
+    uint32_t inboundDropped;
+    uint32_t rawRejected;
+    uint16_t maxQueueLength;
+    uint16_t maxInFlight;
+};
 
 class MQTT
 {
 public:
-    MQTT(WiFiClient *wifiClient, const char *mqttServer, int mqttPort, const char *mqttUser, const char *mqttPassword, const char *mqttRootTopic, bool homeAssistantAutoDiscovery, const char *homeAssistantAutoDiscoveryPrefix);
+    MQTT(const char *mqttServer, int mqttPort, const char *mqttUser, const char *mqttPassword, const char *mqttRootTopic, bool homeAssistantAutoDiscovery, const char *homeAssistantAutoDiscoveryPrefix, bool homeAssistantDeviceDiscovery);
     ~MQTT();
     void setup();
     void loop();
@@ -22,19 +70,57 @@ public:
     bool removeLightbar(Lightbar *lightbar);
     bool addRemote(Remote *remote);
     bool removeRemote(Remote *remote);
+    void setCapture(Capture *capture);
+    void setTransitions(Transitions *transitions);
+    void setRadio(Radio *radio);
+    void setNetwork(Network *network);
+    void setLearner(RemoteLearner *learner);
+    void setReplay(Replay *replay);
+    void setDevices(Devices *devices);
+    void setCluster(Cluster *cluster);
     void onMessage(char *topic, byte *payload, unsigned int length);
     void sendAction(Remote *remote, byte command, byte options);
+    void sendGesture(Gesture *gesture);
+    bool publish(const String &topic, const char *payload, size_t length, uint8_t qos, bool retain);
+    bool publish(const String &topic, const String &payload, uint8_t qos, bool retain);
+    const MQTTStats *getStats();
     const String getCombinedRootTopic();
     const String getClientId();
 
 private:
-    WiFiClient *wifiClient;
-    PubSubClient *client;
+    // The Home Assistant triggers of every remote, announced and removed together.
+    static constexpr uint8_t NUM_REMOTE_TRIGGERS = 6;
+    static constexpr const char *remoteTriggers[NUM_REMOTE_TRIGGERS] = {
+        "press",
+        "turn_clockwise",
+        "turn_counterclockwise",
+        "press_turn_clockwise",
+        "press_turn_counterclockwise",
+        "hold"};
+
+    AsyncMqttClient *client;
     String clientId;
     Lightbar *lightbars[constants::MAX_LIGHTBARS];
+    bool lightbarDiscoveryPending[constants::MAX_LIGHTBARS];
+    LightbarState publishedStates[constants::MAX_LIGHTBARS];
+    bool publishedStateValid[constants::MAX_LIGHTBARS];
+    unsigned long stateChangePendingSince[constants::MAX_LIGHTBARS];
     int lightbarCount = 0;
     Remote *remotes[constants::MAX_REMOTES];
+    bool remoteDiscoveryPending[constants::MAX_REMOTES];
+    unsigned long actionClearTimes[constants::MAX_REMOTES];
     int remoteCount = 0;
+    Capture *capture = nullptr;
+    Transitions *transitions = nullptr;
+    Radio *radio = nullptr;
+    Network *network = nullptr;
+    RemoteLearner *learner = nullptr;
+    Replay *replay = nullptr;
+    Cluster *cluster = nullptr;
+    Devices *devices = nullptr;
+    unsigned long lastLearnPublish = 0;
+    bool debugLog = false;
+    unsigned long lastLogPublish = 0;
     const char *mqttServer;
     int mqttPort = 1883;
     const char *mqttUser = "";
@@ -42,13 +128,81 @@ private:
     String mqttRootTopic = "lightbar2mqtt";
     bool homeAssistantDiscovery = true;
     String homeAssistantDiscoveryPrefix = "homeassistant";
+    bool homeAssistantDeviceDiscovery = false;
 
     String combinedRootTopic;
+    String availabilityTopic;
     std::function<void(Remote *, byte, byte)> remoteCommandHandler;
+    GestureAggregator *gestureAggregator;
+
+    // Set from the client's callbacks, which must not do any real work, and handled in loop().
+    volatile bool connectedEvent = false;
+    volatile bool disconnectedEvent = false;
+    bool connecting = false;
+    unsigned long lastConnectAttempt = 0;
+    uint connectRetries = 0;
+
+    OutboundMessage outbound[constants::MQTT_OUTBOUND_QUEUE_SIZE];
+    uint8_t outboundHead = 0;
+    uint8_t outboundCount = 0;
+    size_t outboundBytes = 0;
+    uint8_t inFlight = 0;
+
+    InboundMessage inbound[constants::MQTT_INBOUND_QUEUE_SIZE];
+    uint8_t inboundHead = 0;
+    uint8_t inboundCount = 0;
+    InboundMessage *inboundPartial = nullptr;
+
+    RawCommand rawCommands[constants::MQTT_RAW_COMMAND_QUEUE_SIZE];
+    uint8_t rawCommandHead = 0;
+    uint8_t rawCommandCount = 0;
+
+    MQTTStats stats = {};
+    unsigned long lastStatsPublish = 0;
+
+    void connect();
+    void onConnected();
+    void onClientMessage(char *topic, char *payload, size_t length, size_t index, size_t total);
+    void onClientPublish(uint16_t packetId);
+    void onRemoteCommand(Remote *remote, byte command, byte options);
+
+    bool onClientRawCommand(char *topic, char *payload, size_t length, size_t index, size_t total);
+    void processInbound();
+    void processRawCommands();
+    void processOutbound();
+    uint8_t getOutboundFree();
 
     void sendAllHomeAssistantDiscoveryMessages();
+    void sendPendingHomeAssistantDiscoveryMessages();
+    const String getHomeAssistantDeviceConfig(const String &ids, const char *name, const char *model, const String &serial);
     void sendHomeAssistantLightbarDiscoveryMessages(Lightbar *lightbar);
     void sendHomeAssistantRemoteDiscoveryMessages(Remote *remote);
+    void clearHomeAssistantLightbarDiscoveryMessages(Lightbar *lightbar);
+    void clearHomeAssistantRemoteDiscoveryMessages(Remote *remote);
+    void sendCaptureBatch();
+    void sendLightbarStates();
+    void sendLightbarState(int index);
+    void sendStats();
+    void sendProfile();
+    void sendRadioStats();
+    void sendNetworkStats();
+    void sendClusterStats();
+    bool claimEvent(uint8_t sequence, uint8_t lastSequence, bool rpd, const ClusterEvent &event);
+    void publishClaimedEvents();
+    void publishGesture(Gesture *gesture);
+    void publishAction(Remote *remote, byte command, byte options);
+    void sendLearnCandidates();
+    void startReplayGenerator(const char *payload);
+    void sendReplayReport();
+    static bool parseSerial(const char *text, uint32_t *serial);
+    bool restoreLightbarState(const char *topic, const char *payload);
+    const String getResultsJson(const uint32_t *results);
+    void promoteRemote(const char *payload);
+    void changeDevices(const char *payload);
+    void sendDevices();
+    void sendStalls();
+    void sendLog();
+    void clearActions();
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,129 @@
+#include "network.h"
+#include "logger.h"
+#include "profiler.h"
+
+Network::Network(const char *ssid, const char *password)
+{
+    this->ssid = ssid;
+    this->password = password;
+}
+
+Network::~Network()
+{
+}
+
+void Network::connect(const String &hostname)
+{
+    PROFILE_SCOPE("wifi.connect");
+    LOG_INFO("[WiFi] Connecting to network \"%s\"...", this->ssid);
+
+    unsigned long start = millis();
+
+    // The connection details are cached in RTC memory, don't wear out the flash by saving them on every connect.
+    WiFi.persistent(false);
+    WiFi.mode(WIFI_STA);
+    WiFi.hostname(hostname);
+
+    bool fast = this->connectFast();
+    if (!fast)
+    {
+        if (!this->connectFull())
+            ESP.restart();
+    }
+
+    this->stats.lastConnectDuration = millis() - start;
+    this->stats.lastConnectFast = fast;
+    if (fast)
+        this->stats.fastConnects++;
+    else
+        this->stats.fullConnects++;
+
+    LOG_INFO("[WiFi] connected in %u ms%s!", this->stats.lastConnectDuration, fast ? " (fast)" : "");
+    LOG_INFO("[WiFi] IP address: %s", WiFi.localIP().toString().c_str());
+}
+
+const NetworkStats *Network::getStats()
+{
+    return &this->stats;
+}
+
+bool Network::connectFast()
+{
+    NetworkCache cache;
+    if (!this->readCache(&cache))
+        return false;
+
+    // Skip the scan by going straight to the last access point. The address still comes from DHCP.
+    WiFi.config(IPAddress(0u), IPAddress(0u), IPAddress(0u));
+    WiFi.begin(this->ssid, this->password, cache.channel, cache.bssid);
+    if (this->waitForConnection(constants::WIFI_FAST_CONNECT_TIMEOUT_MS))
+        return true;
+
+    LOG_WARNING("[WiFi] Fast connect failed, scanning for the network...");
+    this->stats.fastFailures++;
+    this->clearCache();
+    WiFi.disconnect();
+    return false;
+}
+
+bool Network::connectFull()
+{
+    WiFi.begin(this->ssid, this->password);
+    if (!this->waitForConnection(constants::WIFI_CONNECT_TIMEOUT_MS))
+        return false;
+    this->writeCache();
+    return true;
+}
+
+bool Network::waitForConnection(unsigned long timeout)
+{
+    unsigned long start = millis();
+    while (WiFi.status() != WL_CONNECTED)
+    {
+        if (millis() - start >= timeout)
+            return false;
+        delay(constants::WIFI_CONNECT_POLL_INTERVAL_MS);
+    }
+    return true;
+}
+
+bool Network::readCache(NetworkCache *cache)
+{
+    if (!ESP.rtcUserMemoryRead(0, (uint32_t *)cache, sizeof(NetworkCache)))
+        return false;
+    if (cache->magic != Network::CACHE_MAGIC)
+        return false;
+    if (cache->checksum != Network::hash((const uint8_t *)cache, offsetof(NetworkCache, checksum)))
+        return false;
+    // The configuration might have changed since the cache was written.
+    return cache->ssidHash == Network::hash((const uint8_t *)this->ssid, strlen(this->ssid));
+}
+
+void Network::writeCache()
+{
+    NetworkCache cache = {};
+    cache.magic = Network::CACHE_MAGIC;
+    cache.ssidHash = Network::hash((const uint8_t *)this->ssid, strlen(this->ssid));
+    memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+    cache.channel = WiFi.channel();
+    cache.checksum = Network::hash((const uint8_t *)&cache, offsetof(NetworkCache, checksum));
+    ESP.rtcUserMemoryWrite(0, (uint32_t *)&cache, sizeof(NetworkCache));
+}
+
+void Network::clearCache()
+{
+    NetworkCache cache = {};
+    ESP.rtcUserMemoryWrite(0, (uint32_t *)&cache, sizeof(NetworkCache));
+}
+
+uint32_t Network::hash(const uint8_t *data, size_t length)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261UL;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= data[i];
+        hash *= 16777619UL;
+    }
+    return hash;
+}
@@ -0,0 +1,58 @@
+#ifndef NETWORK_H
+#define NETWORK_H
+
+#include <ESP8266WiFi.h>
+
+#include "constants.h"
+
+/*
+ * Everything needed to join the last access point again without scanning. This survives resets (but not power loss)
+ * in the RTC memory and is only trusted if the checksum matches. The address is not cached, it always comes from
+ * DHCP, so the lease is renewed and never outlived.
+ */
+struct NetworkCache
+{
+    uint32_t magic;
+    uint32_t ssidHash;
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t reserved;
+    uint32_t checksum;
+};
+
+struct NetworkStats
+{
+    uint32_t fastConnects;
+    uint32_t fullConnects;
+    uint32_t fastFailures;
+    // Duration of the last successful connect in milliseconds.
+    uint32_t lastConnectDuration;
+    bool lastConnectFast;
+};
+
+class Network
+{
+public:
+    Network(const char *ssid, const char *password);
+    ~Network();
+    void connect(const String &hostname);
+    const NetworkStats *getStats();
+
+private:
+    // Changed whenever the layout of NetworkCache changes.
+    static const uint32_t CACHE_MAGIC = 0x4C324D58;
+
+    const char *ssid;
+    const char *password;
+    NetworkStats stats = {};
+
+    bool connectFast();
+    bool connectFull();
+    bool waitForConnection(unsigned long timeout);
+    bool readCache(NetworkCache *cache);
+    void writeCache();
+    void clearCache();
+    static uint32_t hash(const uint8_t *data, size_t length);
+};
+
+#endif
@@ -0,0 +1,174 @@
+#include "profiler.h"
+
+Profiler profiler;
+
+Profiler::Profiler()
+{
+    this->reset();
+    this->numPendingStalls = 0;
+    this->numStalls = 0;
+}
+
+Profiler::~Profiler()
+{
+}
+
+void Profiler::beginLoop()
+{
+    this->loopStart = micros();
+    this->iterationWorst = {nullptr, 0, 0};
+}
+
+void Profiler::endLoop()
+{
+    uint32_t duration = micros() - this->loopStart;
+
+    this->iterations++;
+    this->maxIteration = max(this->maxIteration, duration);
+    uint8_t bucket = 0;
+    while (bucket < Profiler::NUM_BUCKETS - 1 && (duration >> (bucket + 1)) > 0)
+        bucket++;
+    this->buckets[bucket]++;
+
+    if (duration < constants::LOOP_STALL_THRESHOLD_US)
+        return;
+
+    // Keep the latest stalls until they are picked up, overwrite the oldest ones otherwise.
+    ProfileEvent *stall = &this->stalls[(this->stallHead + this->numPendingStalls) % constants::PROFILER_MAX_STALLS];
+    if (this->numPendingStalls < constants::PROFILER_MAX_STALLS)
+        this->numPendingStalls++;
+    else
+        this->stallHead = (this->stallHead + 1) % constants::PROFILER_MAX_STALLS;
+    stall->tag = this->iterationWorst.tag;
+    stall->micros = duration;
+    stall->timestamp = millis();
+    this->numStalls++;
+}
+
+void Profiler::addSection(const char *tag, uint32_t duration, uint32_t ownDuration)
+{
+    ProfileSection *section = nullptr;
+    for (int i = 0; i < this->numSections; i++)
+    {
+        // Tags are string literals, comparing the pointers is enough.
+        if (this->sections[i].tag == tag)
+        {
+            section = &this->sections[i];
+            break;
+        }
+    }
+    if (section == nullptr && this->numSections < constants::PROFILER_MAX_SECTIONS)
+    {
+        section = &this->sections[this->numSections];
+        this->numSections++;
+        *section = {tag, 0, 0, 0};
+    }
+    if (section != nullptr)
+    {
+        section->count++;
+        section->totalMicros += duration;
+        section->maxMicros = max(section->maxMicros, duration);
+    }
+
+    if (ownDuration > this->iterationWorst.micros)
+        this->iterationWorst = {tag, ownDuration, millis()};
+
+    if (this->numWorst == constants::PROFILER_MAX_WORST && ownDuration <= this->worst[this->numWorst - 1].micros)
+        return;
+    int i = min(this->numWorst, (uint8_t)(constants::PROFILER_MAX_WORST - 1));
+    for (; i > 0 && this->worst[i - 1].micros < ownDuration; i--)
+    {
+        this->worst[i] = this->worst[i - 1];
+    }
+    this->worst[i] = {tag, ownDuration, millis()};
+    if (this->numWorst < constants::PROFILER_MAX_WORST)
+        this->numWorst++;
+}
+
+uint32_t Profiler::getIterations()
+{
+    return this->iterations;
+}
+
+uint32_t Profiler::getPercentile(uint8_t percentile)
+{
+    if (this->iterations == 0)
+        return 0;
+
+    // Returns the upper bound of the bucket the percentile falls into.
+    uint32_t target = ((uint64_t)this->iterations * percentile + 99) / 100;
+    uint32_t count = 0;
+    for (int i = 0; i < Profiler::NUM_BUCKETS; i++)
+    {
+        count += this->buckets[i];
+        if (count >= target)
+            return min((uint32_t)((2UL << i) - 1), this->maxIteration);
+    }
+    return this->maxIteration;
+}
+
+uint32_t Profiler::getMaxIteration()
+{
+    return this->maxIteration;
+}
+
+uint8_t Profiler::getNumSections()
+{
+    return this->numSections;
+}
+
+const ProfileSection *Profiler::getSection(uint8_t index)
+{
+    return &this->sections[index];
+}
+
+uint8_t Profiler::getNumWorst()
+{
+    return this->numWorst;
+}
+
+const ProfileEvent *Profiler::getWorst(uint8_t index)
+{
+    return &this->worst[index];
+}
+
+uint32_t Profiler::getNumStalls()
+{
+    return this->numStalls;
+}
+
+bool Profiler::popStall(ProfileEvent *stall)
+{
+    if (this->numPendingStalls == 0)
+        return false;
+    *stall = this->stalls[this->stallHead];
+    this->stallHead = (this->stallHead + 1) % constants::PROFILER_MAX_STALLS;
+    this->numPendingStalls--;
+    return true;
+}
+
+void Profiler::reset()
+{
+    this->iterations = 0;
+    this->maxIteration = 0;
+    memset(this->buckets, 0, sizeof(this->buckets));
+    this->numSections = 0;
+    this->numWorst = 0;
+}
+
+ProfileScope::ProfileScope(const char *tag)
+{
+    this->tag = tag;
+    this->start = micros();
+    this->parent = profiler.currentScope;
+    profiler.currentScope = this;
+}
+
+ProfileScope::~ProfileScope()
+{
+    uint32_t duration = micros() - this->start;
+    profiler.currentScope = this->parent;
+    if (this->parent != nullptr)
+        this->parent->childMicros += duration;
+    profiler.addSection(this->tag, duration, duration - this->childMicros);
+}
@@ -0,0 +1,98 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "constants.h"
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+// Measures the time until the end of the current scope and accounts it to the given tag.
+#define PROFILE_SCOPE(tag) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(tag)
+
+class ProfileScope;
+
+struct ProfileSection
+{
+    const char *tag;
+    uint32_t count;
+    uint32_t totalMicros;
+    uint32_t maxMicros;
+};
+
+struct ProfileEvent
+{
+    const char *tag;
+    uint32_t micros;
+    unsigned long timestamp;
+};
+
+/*
+ * Measures every iteration of loop() and the time spent in tagged sections. Iteration times are kept in a
+ * histogram with power of two buckets, which is enough to estimate percentiles without storing samples.
+ * Iterations longer than LOOP_STALL_THRESHOLD_US are reported as stalls, together with the slowest section
+ * of that iteration. Sections may be nested. For finding the slowest ones, only the time not spent in nested
+ * sections counts, so the actual offender is reported instead of the loop() call around it.
+ */
+class Profiler
+{
+public:
+    Profiler();
+    ~Profiler();
+    void beginLoop();
+    void endLoop();
+    void addSection(const char *tag, uint32_t duration, uint32_t ownDuration);
+
+    uint32_t getIterations();
+    uint32_t getPercentile(uint8_t percentile);
+    uint32_t getMaxIteration();
+    uint8_t getNumSections();
+    const ProfileSection *getSection(uint8_t index);
+    uint8_t getNumWorst();
+    const ProfileEvent *getWorst(uint8_t index);
+    uint32_t getNumStalls();
+    bool popStall(ProfileEvent *stall);
+    void reset();
+
+    // The innermost running scope, so nested scopes can tell their parent how long they took.
+    ProfileScope *currentScope = nullptr;
+
+private:
+    static const uint8_t NUM_BUCKETS = 24;
+
+    unsigned long loopStart = 0;
+    uint32_t iterations = 0;
+    uint32_t maxIteration = 0;
+    uint32_t buckets[NUM_BUCKETS];
+
+    ProfileSection sections[constants::PROFILER_MAX_SECTIONS];
+    uint8_t numSections = 0;
+
+    // Sorted by duration, slowest first.
+    ProfileEvent worst[constants::PROFILER_MAX_WORST];
+    uint8_t numWorst = 0;
+
+    // The slowest section of the running iteration.
+    ProfileEvent iterationWorst;
+
+    ProfileEvent stalls[constants::PROFILER_MAX_STALLS];
+    uint8_t stallHead = 0;
+    uint8_t numPendingStalls = 0;
+    uint32_t numStalls = 0;
+};
+
+extern Profiler profiler;
+
+class ProfileScope
+{
+public:
+    ProfileScope(const char *tag);
+    ~ProfileScope();
+
+    uint32_t childMicros = 0;
+
+private:
+    const char *tag;
+    unsigned long start;
+    ProfileScope *parent;
+};
+
+#endif
@@ -1,4 +1,6 @@
 #include "radio.h"
+#include "logger.h"
+#include "profiler.h"
 
 /*
  * Package structure:
@@ -25,26 +27,25 @@ bool Radio::addRemote(Remote *remote)
 {
     if (this->num_remotes >= constants::MAX_REMOTES)
     {
-        Serial.println("[Radio] Could not add remote, because too many remotes are saved!");
-        Serial.println("[Radio] Please check if you actually want to save more than " + String(constants::MAX_REMOTES, DEC) + " remotes.");
-        Serial.println("[Radio] If you do, increase MAX_REMOTES in constants.h and recompile.");
+        LOG_ERROR("[Radio] Could not add remote, because too many remotes are saved!");
+        LOG_ERROR("[Radio] Please check if you actually want to save more than %u remotes.", constants::MAX_REMOTES);
+        LOG_ERROR("[Radio] If you do, increase MAX_REMOTES in constants.h and recompile.");
         return false;
     }
-    if (this->num_package_ids >= constants::MAX_SERIALS)
+    RadioRequest request = {RadioRequest::Type::ADD_REMOTE, remote->getSerial()};
+    if (!this->pushRequest(request))
     {
-        Serial.println("[Radio] Could not add remote, because too many serials are saved!");
-        Serial.println("[Radio] Please check if you actually want to save more than " + String(constants::MAX_SERIALS, DEC) + " serials.");
-        Serial.println("[Radio] If you do, increase MAX_SERIALS in constants.h and recompile.");
+        LOG_ERROR("[Radio] Could not add remote, because the request queue is full!");
         return false;
     }
-    this->remotes[this->num_remotes] = remote;
+    int index = this->num_remotes;
+    for (; index > 0 && this->remotes[index - 1]->getSerial() > remote->getSerial(); index--)
+    {
+        this->remotes[index] = this->remotes[index - 1];
+    }
+    this->remotes[index] = remote;
     this->num_remotes++;
-    this->package_ids[this->num_package_ids].serial = remote->getSerial();
-    this->package_ids[this->num_package_ids].package_id = 0;
-    this->num_package_ids++;
-    Serial.print("[Radio] Remote ");
-    Serial.print(remote->getSerialString());
-    Serial.println(" added!");
+    LOG_INFO("[Radio] Remote %s added!", remote->getSerialString().c_str());
     return true;
 }
 
@@ -54,19 +55,12 @@ bool Radio::removeRemote(Remote *remote)
     {
         if (this->remotes[i] == remote)
         {
-            for (int j = 0; j < this->num_package_ids; j++)
+            RadioRequest request = {RadioRequest::Type::REMOVE_REMOTE, remote->getSerial()};
+            if (!this->pushRequest(request))
             {
-                if (this->package_ids[j].serial == remote->getSerial())
-                {
-                    for (int k = j; k < this->num_package_ids - 1; k++)
-                    {
-                        this->package_ids[k] = this->package_ids[k + 1];
-                    }
-                    this->num_package_ids--;
-                    break;
-                }
+                LOG_ERROR("[Radio] Could not remove remote, because the request queue is full!");
+                return false;
             }
-
             for (int j = i; j < this->num_remotes - 1; j++)
             {
                 this->remotes[j] = this->remotes[j + 1];
@@ -78,67 +72,574 @@ bool Radio::removeRemote(Remote *remote)
     return false;
 }
 
-void Radio::sendCommand(uint32_t serial, byte command, byte options)
+bool Radio::addLightbar(uint32_t serial)
+{
+    RadioRequest request = {RadioRequest::Type::ADD_LIGHTBAR, serial};
+    if (!this->pushRequest(request))
+    {
+        LOG_ERROR("[Radio] Could not add light bar, because the request queue is full!");
+        return false;
+    }
+    return true;
+}
+
+bool Radio::removeLightbar(uint32_t serial)
+{
+    RadioRequest request = {RadioRequest::Type::REMOVE_LIGHTBAR, serial};
+    if (!this->pushRequest(request))
+    {
+        LOG_ERROR("[Radio] Could not remove light bar, because the request queue is full!");
+        return false;
+    }
+    return true;
+}
+
+Remote *Radio::findRemote(uint32_t serial)
+{
+    int low = 0;
+    int high = this->num_remotes - 1;
+    while (low <= high)
+    {
+        int middle = (low + high) / 2;
+        uint32_t middle_serial = this->remotes[middle]->getSerial();
+        if (middle_serial == serial)
+            return this->remotes[middle];
+        if (middle_serial < serial)
+            low = middle + 1;
+        else
+            high = middle - 1;
+    }
+    return nullptr;
+}
+
+void Radio::setCapture(Capture *capture)
+{
+    this->capture = capture;
+}
+
+void Radio::setReplay(Replay *replay)
+{
+    this->replay = replay;
+}
+
+void Radio::setReadRpd(bool readRpd)
+{
+    this->read_rpd = readRpd;
+}
+
+void Radio::setLearner(RemoteLearner *learner)
+{
+    this->learner = learner;
+}
+
+void Radio::setCommandListener(std::function<void(uint32_t, uint16_t, bool)> listener)
+{
+    this->command_listener = listener;
+}
+
+bool Radio::sendCommand(uint32_t serial, byte command, byte options, Priority priority, bool supersede, uint16_t *id)
+{
+    RadioRequest request = {RadioRequest::Type::SEND, serial, command, options, priority, supersede, millis(), ++this->next_command_id};
+    if (this->pushRequest(request))
+    {
+        if (id != nullptr)
+            *id = request.id;
+        return true;
+    }
+    LOG_WARNING("[Radio] Dropping command, because the request queue is full!");
+    return false;
+}
+
+bool Radio::sendCommand(uint32_t serial, byte command, byte options)
+{
+    return this->sendCommand(serial, command, options, command == 0x01 || command == 0x06 ? Priority::INTERACTIVE : Priority::NORMAL, false);
+}
+
+bool Radio::sendCommand(uint32_t serial, byte command)
+{
+    return this->sendCommand(serial, command, 0x0);
+}
+
+uint8_t Radio::getQueueLength()
+{
+    return this->queue_length;
+}
+
+const BurstStats *Radio::getBurstStats()
+{
+    return &this->burst_stats;
+}
+
+const TransmitStats *Radio::getTransmitStats(Priority priority)
+{
+    return &this->transmit_stats[priority];
+}
+
+uint8_t Radio::getCommandGroup(byte command)
+{
+    switch (command)
+    {
+    // Cooler / warmer
+    case 0x02:
+    case 0x03:
+        return 1;
+
+    // Brighter / dimmer
+    case 0x04:
+    case 0x05:
+        return 2;
+
+    default:
+        return 0;
+    }
+}
+
+bool Radio::pushRequest(const RadioRequest &request)
+{
+    if (this->requests.push(request))
+        return true;
+    this->dropped_requests++;
+    return false;
+}
+
+void Radio::processEvents()
+{
+    RadioEvent event;
+    while (this->events.pop(event))
+    {
+        if (event.type != RadioEvent::Type::RECEIVED)
+        {
+            if (this->command_listener)
+                this->command_listener(event.serial, event.id, event.type == RadioEvent::Type::SENT);
+            continue;
+        }
+
+        if (event.replayed)
+        {
+            if (event.known)
+                this->replay->countEvent();
+            continue;
+        }
+
+        if (!event.known)
+        {
+            if (this->learner != nullptr && this->learner->isEnabled())
+                this->learner->observe(event.serial, event.package_id);
+            else
+                LOG_INFO("[Radio] Ignoring package with unknown serial: 0x%06X", event.serial);
+            continue;
+        }
+
+        // The remote might have been removed while the event was queued.
+        Remote *remote = this->findRemote(event.serial);
+        if (remote == nullptr)
+            continue;
+        remote->setLastPackage(event.package_id, event.rpd);
+        remote->callback(event.command, event.options);
+    }
+}
+
+uint32_t Radio::getDroppedEvents()
 {
-    PackageIdForSerial *package_id = nullptr;
-    for (int i = 0; i < this->num_package_ids; i++)
+    return this->dropped_events;
+}
+
+uint32_t Radio::getDroppedRequests()
+{
+    return this->dropped_requests;
+}
+
+const ReceiveStats *Radio::getReceiveStats()
+{
+    return &this->receive_stats;
+}
+
+void Radio::processRequests()
+{
+    RadioRequest request;
+    while (this->requests.pop(request))
     {
-        if (this->package_ids[i].serial == serial)
+        switch (request.type)
         {
-            package_id = &this->package_ids[i];
+        case RadioRequest::Type::SEND:
+            this->enqueue(request);
+            break;
+
+        case RadioRequest::Type::ADD_REMOTE:
+        {
+            PackageIdForSerial *package_id = this->addPackageId(request.serial);
+            if (package_id != nullptr)
+                package_id->remote = true;
+            break;
+        }
+
+        case RadioRequest::Type::REMOVE_REMOTE:
+        {
+            // A light bar with the same serial still needs the package ids, otherwise it rejects the next commands.
+            PackageIdForSerial *package_id = this->getPackageId(request.serial);
+            if (package_id == nullptr)
+                break;
+            package_id->remote = false;
+            if (!package_id->lightbar)
+                this->removePackageId(package_id);
+            break;
+        }
+
+        case RadioRequest::Type::ADD_LIGHTBAR:
+        {
+            PackageIdForSerial *package_id = this->addPackageId(request.serial);
+            if (package_id != nullptr)
+                package_id->lightbar = true;
             break;
         }
+
+        case RadioRequest::Type::REMOVE_LIGHTBAR:
+        {
+            // Commands that are still queued would only bring the serial back.
+            for (int i = this->queue_length - 1; i >= 0; i--)
+            {
+                if (this->queue[i].serial != request.serial)
+                    continue;
+                this->reportCommand(this->queue[i], RadioEvent::Type::DROPPED);
+                this->removeFromQueue(i);
+            }
+            PackageIdForSerial *package_id = this->getPackageId(request.serial);
+            if (package_id == nullptr)
+                break;
+            package_id->lightbar = false;
+            if (!package_id->remote)
+                this->removePackageId(package_id);
+            break;
+        }
+        }
     }
-    if (package_id == nullptr)
+}
+
+void Radio::enqueue(const RadioRequest &request)
+{
+    uint32_t serial = request.serial;
+    byte command = request.command;
+    uint8_t priority = request.priority;
+    uint8_t group = Radio::getCommandGroup(command);
+    // An absolute set is a reset to the minimum followed by the value, both are sent or dropped together.
+    bool reset = request.supersede && group != 0;
+    bool completes = !request.supersede && group != 0 && serial == this->reset_serial && group == this->reset_group;
+    bool reset_queued = this->reset_queued;
+    this->reset_group = 0;
+    this->reset_queued = false;
+    QueuedCommand queued = {serial, command, request.options, priority, request.enqueued, request.id, reset, completes};
+
+    if (completes && !reset_queued)
+    {
+        // Without its reset the value would be added to whatever the bar is at.
+        this->transmit_stats[priority].dropped++;
+        this->reportCommand(queued, RadioEvent::Type::DROPPED);
+        return;
+    }
+
+    // Two toggles that were not sent yet cancel each other out.
+    if (command == 0x01)
+    {
+        for (int i = this->queue_length - 1; i >= 0; i--)
+        {
+            if (this->queue[i].serial == serial && this->queue[i].command == command)
+            {
+                this->transmit_stats[this->queue[i].priority].superseded++;
+                this->transmit_stats[priority].superseded++;
+                this->reportCommand(this->queue[i], RadioEvent::Type::DROPPED);
+                this->reportCommand(queued, RadioEvent::Type::DROPPED);
+                this->removeFromQueue(i);
+                return;
+            }
+        }
+    }
+
+    // A command setting an absolute value makes all queued changes of the same value obsolete.
+    if (reset)
+    {
+        for (int i = this->queue_length - 1; i >= 0; i--)
+        {
+            if (this->queue[i].serial == serial && Radio::getCommandGroup(this->queue[i].command) == group)
+            {
+                this->transmit_stats[this->queue[i].priority].superseded++;
+                this->reportCommand(this->queue[i], RadioEvent::Type::DROPPED);
+                this->removeFromQueue(i);
+            }
+        }
+    }
+
+    if (this->queue_length >= constants::TX_QUEUE_SIZE)
     {
-        if (this->num_package_ids >= constants::MAX_SERIALS)
+        // Make room by dropping the newest command with a lower priority, if there is one.
+        // The value of an absolute set whose reset was already sent is never dropped, the bar would stay at its minimum.
+        int victim = -1;
+        for (int i = this->queue_length - 1; i >= 0; i--)
+        {
+            if (this->queue[i].priority > priority && (!this->queue[i].completes || this->findPartner(this->queue[i], i) >= 0))
+            {
+                victim = i;
+                break;
+            }
+        }
+        if (victim < 0)
         {
-            Serial.println("[Radio] Could not send command, because too many serials are saved!");
-            Serial.println("[Radio] Please check if you actually want to save more than " + String(constants::MAX_SERIALS, DEC) + " serials.");
-            Serial.println("[Radio] If you do, increase MAX_SERIALS in constants.h and recompile.");
+            LOG_WARNING("[Radio] Dropping command, because the send queue is full!");
+            this->transmit_stats[priority].dropped++;
+            this->reportCommand(queued, RadioEvent::Type::DROPPED);
+            int partner = this->findPartner(queued, this->queue_length);
+            if (partner >= 0)
+            {
+                this->transmit_stats[this->queue[partner].priority].dropped++;
+                this->reportCommand(this->queue[partner], RadioEvent::Type::DROPPED);
+                this->removeFromQueue(partner);
+            }
             return;
         }
-        package_id = &this->package_ids[this->num_package_ids];
-        package_id->serial = serial;
-        package_id->package_id = 0;
-        this->num_package_ids++;
+        LOG_WARNING("[Radio] Dropping queued command in favour of one with a higher priority!");
+        int partner = this->findPartner(this->queue[victim], victim);
+        this->transmit_stats[this->queue[victim].priority].dropped++;
+        this->reportCommand(this->queue[victim], RadioEvent::Type::DROPPED);
+        this->removeFromQueue(victim);
+        if (partner >= 0)
+        {
+            if (partner > victim)
+                partner--;
+            this->transmit_stats[this->queue[partner].priority].dropped++;
+            this->reportCommand(this->queue[partner], RadioEvent::Type::DROPPED);
+            this->removeFromQueue(partner);
+        }
     }
 
-    byte data[17] = {0};
-    memcpy(data, Radio::preamble, sizeof(Radio::preamble));
-    data[8] = (serial & 0xFF0000) >> 16;
-    data[9] = (serial & 0x00FF00) >> 8;
-    data[10] = serial & 0x0000FF;
-    data[11] = 0xFF;
-    data[12] = ++package_id->package_id;
-    data[13] = command;
-    data[14] = options;
+    this->queue[this->queue_length] = queued;
+    this->queue_length++;
+    if (reset)
+    {
+        this->reset_serial = serial;
+        this->reset_group = group;
+        this->reset_queued = true;
+    }
+}
 
-    this->crc.restart();
-    this->crc.add(data, sizeof(data) - 2);
-    uint16_t checksum = this->crc.calc();
-    data[15] = (checksum & 0xFF00) >> 8;
-    data[16] = checksum & 0x00FF;
+void Radio::removeFromQueue(uint8_t index)
+{
+    for (int i = index; i < this->queue_length - 1; i++)
+    {
+        this->queue[i] = this->queue[i + 1];
+    }
+    this->queue_length--;
+}
 
-    Serial.print("[Radio] Sending command: 0x");
-    for (int i = 0; i < 17; i++)
+// Returns the queued other half of the absolute set the command at the index belongs to, or -1 if there is none.
+// The index may be the end of the queue for a command not queued yet.
+int Radio::findPartner(const QueuedCommand &command, int index)
+{
+    uint8_t group = Radio::getCommandGroup(command.command);
+    if (command.completes)
     {
-        Serial.print(data[i], HEX);
+        for (int i = index - 1; i >= 0; i--)
+        {
+            if (this->queue[i].serial == command.serial && Radio::getCommandGroup(this->queue[i].command) == group)
+                return this->queue[i].reset ? i : -1;
+        }
+    }
+    else if (command.reset)
+    {
+        for (int i = index + 1; i < this->queue_length; i++)
+        {
+            if (this->queue[i].serial == command.serial && Radio::getCommandGroup(this->queue[i].command) == group)
+                return this->queue[i].completes ? i : -1;
+        }
     }
-    Serial.println();
+    return -1;
+}
 
-    this->radio.stopListening();
-    for (int i = 0; i < 20; i++)
+PackageIdForSerial *Radio::getPackageId(uint32_t serial)
+{
+    int low = 0;
+    int high = this->num_package_ids - 1;
+    while (low <= high)
     {
-        this->radio.write(&data, sizeof(data), true);
-        delay(10);
+        int middle = (low + high) / 2;
+        if (this->package_ids[middle].serial == serial)
+            return &this->package_ids[middle];
+        if (this->package_ids[middle].serial < serial)
+            low = middle + 1;
+        else
+            high = middle - 1;
     }
-    this->radio.startListening();
+    return nullptr;
 }
 
-void Radio::sendCommand(uint32_t serial, byte command)
+PackageIdForSerial *Radio::addPackageId(uint32_t serial)
 {
-    return this->sendCommand(serial, command, 0x0);
+    PackageIdForSerial *package_id = this->getPackageId(serial);
+    if (package_id != nullptr)
+        return package_id;
+
+    if (this->num_package_ids >= constants::MAX_SERIALS)
+    {
+        LOG_ERROR("[Radio] Could not save package id, because too many serials are saved!");
+        LOG_ERROR("[Radio] Please check if you actually want to save more than %u serials.", constants::MAX_SERIALS);
+        LOG_ERROR("[Radio] If you do, increase MAX_SERIALS in constants.h and recompile.");
+        return nullptr;
+    }
+    int index = this->num_package_ids;
+    for (; index > 0 && this->package_ids[index - 1].serial > serial; index--)
+    {
+        this->package_ids[index] = this->package_ids[index - 1];
+    }
+    this->package_ids[index] = {serial, 0, 0, false, false};
+    this->num_package_ids++;
+    return &this->package_ids[index];
+}
+
+void Radio::removePackageId(PackageIdForSerial *package_id)
+{
+    for (int i = package_id - this->package_ids; i < this->num_package_ids - 1; i++)
+    {
+        this->package_ids[i] = this->package_ids[i + 1];
+    }
+    this->num_package_ids--;
+}
+
+void Radio::transmitNext()
+{
+    if (this->queue_length == 0)
+        return;
+
+    uint8_t priority = Radio::NUM_PRIORITIES;
+    for (int i = 0; i < this->queue_length; i++)
+    {
+        priority = min(priority, this->queue[i].priority);
+    }
+
+    // Within the highest priority, serve the serial that waited the longest since its last transmission.
+    // Commands of the same serial are always sent in order.
+    int next = -1;
+    uint32_t next_last_transmission = 0;
+    for (int i = 0; i < this->queue_length; i++)
+    {
+        if (this->queue[i].priority != priority)
+            continue;
+        PackageIdForSerial *package_id = this->getPackageId(this->queue[i].serial);
+        uint32_t last_transmission = package_id != nullptr ? package_id->last_transmission : 0;
+        if (next < 0 || last_transmission < next_last_transmission)
+        {
+            next = i;
+            next_last_transmission = last_transmission;
+        }
+    }
+
+    QueuedCommand command = this->queue[next];
+    this->removeFromQueue(next);
+
+    uint32_t wait = millis() - command.enqueued;
+    TransmitStats *stats = &this->transmit_stats[command.priority];
+    stats->sent++;
+    stats->totalWait += wait;
+    stats->maxWait = max(stats->maxWait, wait);
+
+    // The outcome is only known once the burst is over.
+    if (!this->transmit(command))
+        this->reportCommand(command, RadioEvent::Type::DROPPED);
+}
+
+bool Radio::transmit(const QueuedCommand &command)
+{
+    PackageIdForSerial *package_id = this->addPackageId(command.serial);
+    if (package_id == nullptr)
+        return false;
+    package_id->last_transmission = ++this->num_transmissions;
+
+    byte data[17];
+    Radio::buildPackage(command.serial, ++package_id->package_id, command.command, command.options, data);
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+    char hex[sizeof(data) * 2 + 1];
+    for (int i = 0; i < sizeof(data); i++)
+    {
+        snprintf(hex + i * 2, 3, "%02X", data[i]);
+    }
+    LOG_DEBUG("[Radio] Sending command: 0x%s", hex);
+#endif
+
+    unsigned long start = micros();
+    this->radio.stopListening();
+    memcpy(this->burst.data, data, sizeof(data));
+    this->burst.command = command;
+    this->burst.active = true;
+    this->burst.remaining = constants::TX_REPEAT_COUNT;
+    this->burst.started = micros();
+    this->burst.next = this->burst.started;
+    this->burst.spiTransactions = 2;
+    this->burst.cpuMicros = micros() - start;
+    this->continueBurst();
+    return true;
+}
+
+void Radio::continueBurst()
+{
+    PROFILE_SCOPE("radio.send");
+    unsigned long start = micros();
+    TransmitBurst *burst = &this->burst;
+
+    // Keep the FIFO topped up with the repeats that are due. If it is full, the rest has to wait for the next loop.
+    while (burst->remaining > 0 && (long)(micros() - burst->next) >= 0)
+    {
+        burst->spiTransactions++;
+        if (this->radio.isFifo(true, false))
+            break;
+        // Checks the status and writes the payload. Light bars don't acknowledge, so send it like a multicast.
+        this->radio.writeFast(&burst->data, sizeof(burst->data), true);
+        burst->spiTransactions += 2;
+        burst->remaining--;
+        burst->next += constants::TX_PACKET_SPACING_US;
+        // Don't catch up after a slow loop, the repeats are meant to be spread out.
+        if (constants::TX_PACKET_SPACING_US > 0 && (long)(micros() - burst->next) > 0)
+            burst->next = micros() + constants::TX_PACKET_SPACING_US;
+    }
+
+    bool done = false;
+    bool aborted = false;
+    if (burst->remaining == 0)
+    {
+        burst->spiTransactions++;
+        done = this->radio.isFifo(true, true);
+        if (!done && (long)(micros() - burst->next) > (long)constants::TX_DRAIN_TIMEOUT_US)
+        {
+            LOG_ERROR("[Radio] TX FIFO did not run empty, aborting burst!");
+            this->radio.flush_tx();
+            this->radio.txStandBy();
+            this->radio.startListening();
+            burst->active = false;
+            aborted = true;
+            this->burst_stats.aborted++;
+            this->reportCommand(burst->command, RadioEvent::Type::DROPPED);
+        }
+    }
+    if (done)
+    {
+        uint32_t air = micros() - burst->started;
+        // Waits for the FIFO, which is empty already, and leaves the TX mode.
+        this->radio.txStandBy();
+        this->radio.startListening();
+        burst->spiTransactions += 4;
+        burst->active = false;
+        this->reportCommand(burst->command, RadioEvent::Type::SENT);
+
+        this->burst_stats.bursts++;
+        this->burst_stats.packets += constants::TX_REPEAT_COUNT;
+        this->burst_stats.spiTransactions += burst->spiTransactions;
+        this->burst_stats.airMicros += air;
+    }
+
+    // Aborted bursts cost CPU time as well, only their air time and SPI transactions are left out.
+    burst->cpuMicros += micros() - start;
+    if (done || aborted)
+    {
+        this->burst_stats.cpuMicros += burst->cpuMicros;
+        this->burst_stats.maxCpuMicros = max(this->burst_stats.maxCpuMicros, burst->cpuMicros);
+    }
 }
 
 void Radio::setup()
@@ -146,14 +647,14 @@ void Radio::setup()
     uint retries = 0;
     while (!this->radio.begin())
     {
-        Serial.println("[Radio] nRF24 not responding! Is it wired correctly?");
+        LOG_ERROR("[Radio] nRF24 not responding! Is it wired correctly?");
         delay(1000);
         retries++;
         if (retries > 60)
             ESP.restart();
     }
 
-    Serial.println("[Radio] Setting up radio...");
+    LOG_INFO("[Radio] Setting up radio...");
     this->radio.failureDetected = false;
 
     this->radio.openReadingPipe(0, Radio::address);
@@ -169,42 +670,68 @@ void Radio::setup()
     this->radio.openWritingPipe(Radio::address);
 
     this->radio.startListening();
-    Serial.println("[Radio] done!");
+    LOG_INFO("[Radio] done!");
 }
 
 void Radio::loop()
 {
     if (this->radio.failureDetected)
     {
-        Serial.println("[Radio] Failure detected!");
+        LOG_ERROR("[Radio] Failure detected!");
+        if (this->burst.active)
+        {
+            this->burst.active = false;
+            this->burst_stats.aborted++;
+            this->reportCommand(this->burst.command, RadioEvent::Type::DROPPED);
+        }
         delay(1000);
         this->setup();
         delay(1000);
     }
 
-    if (this->radio.available())
+    this->processRequests();
+
+    // Nothing can be received while a command is being sent.
+    if (this->burst.active)
+        this->continueBurst();
+    else if (this->radio.available())
         this->handlePackage();
+
+    if (this->replay != nullptr)
+    {
+        ReplayFrame frame;
+        for (int i = 0; i < constants::REPLAY_MAX_FRAMES_PER_LOOP && this->replay->poll(&frame); i++)
+        {
+            this->processPackage(frame.raw, micros(), false, &frame);
+        }
+    }
+
+    // The radio sends one command at a time.
+    if (!this->burst.active)
+        this->transmitNext();
 }
 
 void Radio::handlePackage()
 {
-    // Read raw data, append a 5 and shift it. See
-    // https://github.com/lamperez/xiaomi-lightbar-nrf24?tab=readme-ov-file#baseband-packet-format
-    // on why that is necessary.
-    byte raw_data[18] = {0};
+    PROFILE_SCOPE("radio.receive");
+    byte raw_data[Capture::RAW_LENGTH] = {0};
+    unsigned long timestamp = micros();
     this->radio.read(&raw_data, sizeof(raw_data));
-    byte data[17] = {0x5};
-    for (int i = 0; i < 17; i++)
-    {
-        if (i == 0)
-            data[i] = 0x50 | raw_data[i] >> 5;
-        else
-            data[i] = ((raw_data[i - 1] >> 1) & 0x0F) << 4 | ((raw_data[i - 1] & 0x01) << 3) | raw_data[i] >> 5;
-    }
+    bool rpd = (this->read_rpd || (this->capture != nullptr && this->capture->isEnabled())) && this->radio.testRPD();
+    this->processPackage(raw_data, timestamp, rpd, nullptr);
+}
+
+void Radio::processPackage(const byte *raw_data, unsigned long timestamp, bool rpd, const ReplayFrame *replayed)
+{
+    byte data[Capture::DECODED_LENGTH];
+    Radio::decodePackage(raw_data, data);
 
     // Check if preamble matches. Ignore package otherwise.
     if (memcmp(data, Radio::preamble, sizeof(Radio::preamble)))
+    {
+        this->recordResult(Capture::Result::WRONG_PREAMBLE, timestamp, rpd, replayed != nullptr, raw_data, data);
         return;
+    }
 
     // Make sure the checksum of the package is correct.
     this->crc.restart();
@@ -213,56 +740,113 @@ void Radio::handlePackage()
     uint16_t package_checksum = data[15] << 8 | data[16];
     if (calculated_checksum != package_checksum)
     {
-        Serial.println("[Radio] Ignoring pacakge with wrong checksum!");
+        LOG_DEBUG("[Radio] Ignoring package with wrong checksum!");
+        this->recordResult(Capture::Result::WRONG_CHECKSUM, timestamp, rpd, replayed != nullptr, raw_data, data);
         return;
     }
 
     // Check if package is coming from a observed remote.
-    Remote *remote = nullptr;
     uint32_t serial = data[8] << 16 | data[9] << 8 | data[10];
-    for (int i = 0; i < this->num_remotes; i++)
+    uint8_t package_id = data[12];
+    // Replayed frames have their own sequence numbers, so they never move the ones of the real remotes ahead.
+    uint8_t *last_package_id = nullptr;
+    if (replayed != nullptr)
     {
-
-        if (serial == this->remotes[i]->getSerial())
-        {
-            remote = this->remotes[i];
-            break;
-        }
+        last_package_id = this->replay->getPackageId(replayed, serial, package_id);
     }
-
-    if (remote == nullptr)
+    else
     {
-        Serial.print("[Radio] Ignoring package with unknown serial: 0x");
-        Serial.print(serial, HEX);
-        Serial.println("");
+        PackageIdForSerial *package_id_for_serial = this->getPackageId(serial);
+        if (package_id_for_serial != nullptr && package_id_for_serial->remote)
+            last_package_id = &package_id_for_serial->package_id;
+    }
+    if (last_package_id == nullptr)
+    {
+        // Pass it on anyway, the controller side decides whether it is interesting for learning.
+        this->recordResult(Capture::Result::UNKNOWN_SERIAL, timestamp, rpd, replayed != nullptr, raw_data, data);
+        this->pushEvent({serial, data[13], data[14], package_id, false, rpd, replayed != nullptr});
         return;
     }
 
-    // Make sure the same package was not handled before.
-    uint8_t package_id = data[12];
-    PackageIdForSerial *package_id_for_serial = nullptr;
-    for (int i = 0; i < this->num_package_ids; i++)
+    // The remote repeats every package multiple times. Ignore everything up to 64 packages behind the latest
+    // one, taking the wrap around of the 8 bit counter into account.
+    uint8_t package_id_delta = package_id - *last_package_id;
+    if (package_id_delta == 0 || package_id_delta > 256 - 64)
     {
-        if (this->package_ids[i].serial == serial)
-        {
-            package_id_for_serial = &this->package_ids[i];
-            break;
-        }
+        LOG_DEBUG("[Radio] Ignoring package with too low package number!");
+        this->recordResult(Capture::Result::DUPLICATE, timestamp, rpd, replayed != nullptr, raw_data, data);
+        return;
     }
-    if (package_id_for_serial == nullptr)
+    *last_package_id = package_id;
+
+    LOG_DEBUG("[Radio] Package received!");
+    this->recordResult(Capture::Result::ACCEPTED, timestamp, rpd, replayed != nullptr, raw_data, data);
+    this->pushEvent({serial, data[13], data[14], package_id, true, rpd, replayed != nullptr});
+}
+
+void Radio::pushEvent(const RadioEvent &event)
+{
+    if (!this->events.push(event))
+        this->dropped_events++;
+}
+
+void Radio::reportCommand(const QueuedCommand &command, RadioEvent::Type type)
+{
+    this->pushEvent({command.serial, command.command, command.options, 0, false, false, false, type, command.id});
+}
+
+void Radio::recordResult(Capture::Result result, unsigned long timestamp, bool rpd, bool replayed, const byte *raw_data, const byte *data)
+{
+    // Replayed frames are kept apart, so they neither show up in the statistics nor get captured again.
+    if (replayed)
     {
-        Serial.print("[Radio] Could not find latest package id for serial 0x");
-        Serial.print(serial, HEX);
-        Serial.println("!");
+        this->replay->countResult(result);
         return;
     }
-    if (package_id <= package_id_for_serial->serial && package_id > package_id_for_serial->serial - 64)
+    this->receive_stats.results[result]++;
+    if (this->capture != nullptr)
+        this->capture->record(timestamp, result, rpd, raw_data, data);
+}
+
+void Radio::decodePackage(const byte *raw_data, byte *data)
+{
+    // Append a 5 and shift the raw data. See
+    // https://github.com/lamperez/xiaomi-lightbar-nrf24?tab=readme-ov-file#baseband-packet-format
+    // on why that is necessary.
+    for (int i = 0; i < Capture::DECODED_LENGTH; i++)
     {
-        Serial.println("[Radio] Ignoring package with too low package number!");
-        return;
+        if (i == 0)
+            data[i] = 0x50 | raw_data[i] >> 5;
+        else
+            data[i] = ((raw_data[i - 1] >> 1) & 0x0F) << 4 | ((raw_data[i - 1] & 0x01) << 3) | raw_data[i] >> 5;
+    }
+}
+
+void Radio::encodePackage(const byte *data, byte *raw_data)
+{
+    // The reverse of decodePackage(). The upper five bits of the first byte are implied.
+    for (int i = 0; i < Capture::RAW_LENGTH; i++)
+    {
+        byte current = i < Capture::DECODED_LENGTH ? data[i] : 0x00;
+        byte next = i + 1 < Capture::DECODED_LENGTH ? data[i + 1] : 0x00;
+        raw_data[i] = (current & 0x07) << 5 | ((next >> 4) & 0x0F) << 1 | ((next >> 3) & 0x01);
     }
-    package_id_for_serial->package_id = package_id;
+}
 
-    Serial.println("[Radio] Package received!");
-    remote->callback(data[13], data[14]);
-}
\ No newline at end of file
+void Radio::buildPackage(uint32_t serial, uint8_t package_id, byte command, byte options, byte *data)
+{
+    memcpy(data, Radio::preamble, sizeof(Radio::preamble));
+    data[8] = (serial & 0xFF0000) >> 16;
+    data[9] = (serial & 0x00FF00) >> 8;
+    data[10] = serial & 0x0000FF;
+    data[11] = 0xFF;
+    data[12] = package_id;
+    data[13] = command;
+    data[14] = options;
+
+    CRC16 crc = CRC16(0x1021, 0xfffe, 0x0000, false, false);
+    crc.add(data, Capture::DECODED_LENGTH - 2);
+    uint16_t checksum = crc.calc();
+    data[15] = (checksum & 0xFF00) >> 8;
+    data[16] = checksum & 0x00FF;
+}
@@ -6,6 +6,10 @@
 
 #include "constants.h"
 #include "remote.h"
+#include "capture.h"
+#include "learner.h"
+#include "spsc_queue.h"
+#include "replay.h"
 
 class Remote;
 
@@ -13,27 +17,204 @@ struct PackageIdForSerial
 {
     uint32_t serial;
     uint8_t package_id;
+    // The number of the last transmission to this serial, used to share the radio fairly between serials.
+    uint32_t last_transmission;
+    // Whether packages from this serial are passed on.
+    bool remote;
+    // Whether a light bar is controlled with this serial. A remote with the same serial shares its package ids.
+    bool lightbar;
+};
+
+// A package received from a remote, or the outcome of a command, passed from the radio to the rest of the controller.
+struct RadioEvent
+{
+    enum Type : uint8_t
+    {
+        RECEIVED,
+        SENT,
+        DROPPED
+    };
+
+    uint32_t serial;
+    byte command;
+    byte options;
+    uint8_t package_id;
+    // False for valid packages of serials that are not added as remote.
+    bool known;
+    bool rpd;
+    bool replayed;
+    Type type;
+    // The ID of the command, for SENT and DROPPED.
+    uint16_t id;
+};
+
+// Number of received frames per stage they were accepted or rejected at, indexed by Capture::Result.
+struct ReceiveStats
+{
+    uint32_t results[Capture::NUM_RESULTS];
+};
+
+// Work for the radio, passed from the rest of the controller to the radio.
+struct RadioRequest
+{
+    enum Type : uint8_t
+    {
+        SEND,
+        ADD_REMOTE,
+        REMOVE_REMOTE,
+        ADD_LIGHTBAR,
+        REMOVE_LIGHTBAR
+    };
+
+    Type type;
+    uint32_t serial;
+    byte command;
+    byte options;
+    uint8_t priority;
+    bool supersede;
+    unsigned long enqueued;
+    uint16_t id;
+};
+
+struct QueuedCommand
+{
+    uint32_t serial;
+    byte command;
+    byte options;
+    uint8_t priority;
+    unsigned long enqueued;
+    uint16_t id;
+    // The first half of an absolute set, resetting the value to its minimum.
+    bool reset;
+    // The second half of an absolute set, only sent together with the reset before it.
+    bool completes;
+};
+
+// A command being sent, one repeat after another.
+struct TransmitBurst
+{
+    bool active;
+    // Reported as sent once the FIFO ran empty, or as dropped if the burst is aborted.
+    QueuedCommand command;
+    byte data[17];
+    // Repeats not written to the FIFO yet.
+    uint8_t remaining;
+    // When the next repeat is due, in microseconds.
+    unsigned long next;
+    unsigned long started;
+    // Estimated, see BurstStats.
+    uint32_t spiTransactions;
+    uint32_t cpuMicros;
+};
+
+struct BurstStats
+{
+    uint32_t bursts;
+    uint32_t packets;
+    uint32_t aborted;
+    // Issued by the RF24 calls of the completed bursts. Not counted on the bus, but estimated from what each call
+    // does, so a change of the RF24 library can make it wrong.
+    uint32_t spiTransactions;
+    // Time spent in completed and aborted bursts, excluding the time the main loop did anything else.
+    uint32_t cpuMicros;
+    uint32_t maxCpuMicros;
+    // Time from the first repeat until the FIFO ran empty.
+    uint32_t airMicros;
+};
+
+struct TransmitStats
+{
+    uint32_t sent;
+    uint32_t superseded;
+    uint32_t dropped;
+    uint32_t totalWait;
+    uint32_t maxWait;
 };
 
 class Radio
 {
 public:
+    enum Priority
+    {
+        // On/off and pairing, the user is waiting for these.
+        INTERACTIVE = 0,
+        NORMAL = 1,
+        // Single steps of transitions and the like.
+        BULK = 2
+    };
+    static const uint8_t NUM_PRIORITIES = 3;
+
     Radio(uint8_t ce, uint8_t csn);
     ~Radio();
+
+    // The radio side: talks to the nRF24 and owns everything needed for receiving and sending packages.
     void setup();
-    void sendCommand(uint32_t serial, byte command, byte options);
-    void sendCommand(uint32_t serial, byte command);
     void loop();
+    void setCapture(Capture *capture);
+    void setReplay(Replay *replay);
+    void setReadRpd(bool readRpd);
+
+    // The controller side: remotes, light bars and MQTT. Only talks to the radio side through the queues.
+    bool sendCommand(uint32_t serial, byte command, byte options, Priority priority, bool supersede, uint16_t *id = nullptr);
+    bool sendCommand(uint32_t serial, byte command, byte options);
+    bool sendCommand(uint32_t serial, byte command);
+    void processEvents();
     bool addRemote(Remote *remote);
     bool removeRemote(Remote *remote);
+    Remote *findRemote(uint32_t serial);
+    bool addLightbar(uint32_t serial);
+    bool removeLightbar(uint32_t serial);
+    void setLearner(RemoteLearner *learner);
+    void setCommandListener(std::function<void(uint32_t, uint16_t, bool)> listener);
+
+    uint8_t getQueueLength();
+    const TransmitStats *getTransmitStats(Priority priority);
+    const BurstStats *getBurstStats();
+    uint32_t getDroppedEvents();
+    uint32_t getDroppedRequests();
+    const ReceiveStats *getReceiveStats();
+
+    static void buildPackage(uint32_t serial, uint8_t package_id, byte command, byte options, byte *data);
+    static void decodePackage(const byte *raw_data, byte *data);
+    static void encodePackage(const byte *data, byte *raw_data);
 
 private:
+    SpscQueue<RadioEvent, constants::RADIO_EVENT_QUEUE_SIZE> events;
+    SpscQueue<RadioRequest, constants::RADIO_REQUEST_QUEUE_SIZE> requests;
+    // Each counter is only written by the producer of its queue.
+    uint32_t dropped_events = 0;
+    uint32_t dropped_requests = 0;
+
+    // Controller side
+    // Sorted by serial, so remotes can be looked up with a binary search.
+    Remote *remotes[constants::MAX_REMOTES];
+    uint8_t num_remotes = 0;
+    RemoteLearner *learner = nullptr;
+    // Told whether each command was sent or dropped, by serial and ID.
+    std::function<void(uint32_t, uint16_t, bool)> command_listener;
+    uint16_t next_command_id = 0;
+
+    // Radio side
     RF24 radio;
+    // Sorted by serial, so they can be looked up with a binary search.
     PackageIdForSerial package_ids[constants::MAX_SERIALS];
     uint8_t num_package_ids = 0;
+    Capture *capture = nullptr;
+    Replay *replay = nullptr;
+    // Whether to read the received power detector for every package, not only while capturing.
+    bool read_rpd = false;
+    ReceiveStats receive_stats = {};
 
-    Remote *remotes[constants::MAX_REMOTES];
-    uint8_t num_remotes = 0;
+    QueuedCommand queue[constants::TX_QUEUE_SIZE];
+    uint8_t queue_length = 0;
+    // The reset of the last absolute set, so the value following it can be tied to it.
+    uint32_t reset_serial = 0;
+    uint8_t reset_group = 0;
+    bool reset_queued = false;
+    uint32_t num_transmissions = 0;
+    TransmitStats transmit_stats[Radio::NUM_PRIORITIES] = {};
+    TransmitBurst burst = {};
+    BurstStats burst_stats = {};
 
     static const uint64_t address = 0xAAAAAAAAAAAA;
     static constexpr byte preamble[8] = {0x53, 0x39, 0x14, 0xDD, 0x1C, 0x49, 0x34, 0x12};
@@ -42,7 +223,23 @@ private:
     // https://github.com/lamperez/xiaomi-lightbar-nrf24?tab=readme-ov-file#crc-checksum
     CRC16 crc = CRC16(0x1021, 0xfffe, 0x0000, false, false);
 
+    bool pushRequest(const RadioRequest &request);
+    void processRequests();
+    void enqueue(const RadioRequest &request);
     void handlePackage();
+    void processPackage(const byte *raw_data, unsigned long timestamp, bool rpd, const ReplayFrame *replayed);
+    void recordResult(Capture::Result result, unsigned long timestamp, bool rpd, bool replayed, const byte *raw_data, const byte *data);
+    void pushEvent(const RadioEvent &event);
+    void reportCommand(const QueuedCommand &command, RadioEvent::Type type);
+    PackageIdForSerial *getPackageId(uint32_t serial);
+    PackageIdForSerial *addPackageId(uint32_t serial);
+    void removePackageId(PackageIdForSerial *package_id);
+    void removeFromQueue(uint8_t index);
+    int findPartner(const QueuedCommand &command, int index);
+    void transmitNext();
+    bool transmit(const QueuedCommand &command);
+    void continueBurst();
+    static uint8_t getCommandGroup(byte command);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,31 @@
+#include "raw_command.h"
+
+bool RawCommand::decode(const byte *data, size_t length)
+{
+    if (length != RawCommand::LENGTH || data[0] != RawCommand::VERSION)
+        return false;
+
+    this->flags = data[1];
+    this->brightness = data[2];
+    this->temperature = data[3];
+    this->command = data[4];
+    this->options = data[5];
+    return true;
+}
+
+void RawCommand::merge(const RawCommand *newer)
+{
+    // Newer values replace older ones, values only set in the older frame are kept.
+    if (newer->flags & RawCommand::FLAG_STATE)
+        this->flags = (this->flags & ~RawCommand::FLAG_ON) | (newer->flags & RawCommand::FLAG_ON);
+    if (newer->flags & RawCommand::FLAG_BRIGHTNESS)
+        this->brightness = newer->brightness;
+    if (newer->flags & RawCommand::FLAG_TEMPERATURE)
+        this->temperature = newer->temperature;
+    if (newer->flags & RawCommand::FLAG_COMMAND)
+    {
+        this->command = newer->command;
+        this->options = newer->options;
+    }
+    this->flags |= newer->flags & ~RawCommand::FLAG_ON;
+}
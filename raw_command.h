@@ -0,0 +1,45 @@
+#ifndef RAW_COMMAND_H
+#define RAW_COMMAND_H
+
+#include "constants.h"
+
+/*
+ * Binary command frame, version 1:
+ *  0 – 0: Version (0x01)
+ *  1 – 1: Flags
+ *           bit 0: Set on/off state
+ *           bit 1: On/off state (1 = on)
+ *           bit 2: Set brightness
+ *           bit 3: Set temperature
+ *           bit 4: Send raw command
+ *  2 – 2: Brightness (0 – 15)
+ *  3 – 3: Temperature (0 – 15, as used by Lightbar::setTemperature())
+ *  4 – 4: Raw command (see Lightbar::Command)
+ *  5 – 5: Raw command options
+ *
+ * Frames with an unknown version or length are rejected, so the format can be extended with new versions later.
+ * Values that are not flagged are ignored.
+ */
+struct RawCommand
+{
+    static const uint8_t VERSION = 0x01;
+    static const uint8_t LENGTH = 6;
+
+    static const uint8_t FLAG_STATE = 0x01;
+    static const uint8_t FLAG_ON = 0x02;
+    static const uint8_t FLAG_BRIGHTNESS = 0x04;
+    static const uint8_t FLAG_TEMPERATURE = 0x08;
+    static const uint8_t FLAG_COMMAND = 0x10;
+
+    uint32_t serial;
+    uint8_t flags;
+    uint8_t brightness;
+    uint8_t temperature;
+    byte command;
+    byte options;
+
+    bool decode(const byte *data, size_t length);
+    void merge(const RawCommand *newer);
+};
+
+#endif
@@ -1,14 +1,15 @@
 #include "remote.h"
+#include "logger.h"
 
 Remote::Remote(Radio *radio, uint32_t serial, const char *name)
 {
     this->radio = radio;
     this->serial = serial;
-    this->name = name;
+    // Keep a copy of the name, remotes learned at runtime don't have one that lives forever.
+    this->name = String(name);
+    this->serialString = "0x" + String(this->serial, HEX);
 
     this->radio->addRemote(this);
-
-    this->serialString = "0x" + String(this->serial, HEX);
 }
 
 Remote::~Remote()
@@ -27,27 +28,57 @@ String Remote::getSerialString()
 
 const char *Remote::getName()
 {
-    return this->name;
+    return this->name.c_str();
+}
+
+uint8_t Remote::getLastPackageId()
+{
+    return this->lastPackageId;
+}
+
+bool Remote::getLastRpd()
+{
+    return this->lastRpd;
+}
+
+void Remote::setLastPackage(uint8_t packageId, bool rpd)
+{
+    this->lastPackageId = packageId;
+    this->lastRpd = rpd;
 }
 
 void Remote::callback(byte command, byte options)
 {
     for (int i = 0; i < this->numCommandListeners; i++)
     {
-        this->commandListeners[i](this, command, options);
+        this->commandListeners[i].callback(this, command, options);
     }
 }
 
-bool Remote::registerCommandListener(std::function<void(Remote *, byte, byte)> callback)
+bool Remote::registerCommandListener(std::function<void(Remote *, byte, byte)> callback, const void *owner)
 {
     if (this->numCommandListeners >= constants::MAX_COMMAND_LISTENERS)
     {
-        Serial.println("[Remote] Could not add command listener to remote, because too many are saved!");
-        Serial.println("[Remote] Please check if you actually want to save more than " + String(constants::MAX_COMMAND_LISTENERS, DEC) + " command listeners.");
-        Serial.println("[Remote] If you do, increase MAX_COMMAND_LISTENERS in constants.h and recompile.");
+        LOG_ERROR("[Remote] Could not add command listener to remote, because too many are saved!");
+        LOG_ERROR("[Remote] Please check if you actually want to save more than %u command listeners.", constants::MAX_COMMAND_LISTENERS);
+        LOG_ERROR("[Remote] If you do, increase MAX_COMMAND_LISTENERS in constants.h and recompile.");
         return false;
     }
-    this->commandListeners[this->numCommandListeners] = callback;
+    this->commandListeners[this->numCommandListeners] = {callback, owner};
     this->numCommandListeners++;
     return true;
 }
+
+void Remote::unregisterCommandListeners(const void *owner)
+{
+    for (int i = this->numCommandListeners - 1; i >= 0; i--)
+    {
+        if (this->commandListeners[i].owner != owner)
+            continue;
+        for (int j = i; j < this->numCommandListeners - 1; j++)
+        {
+            this->commandListeners[j] = this->commandListeners[j + 1];
+        }
+        this->numCommandListeners--;
+    }
+}
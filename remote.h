@@ -5,6 +5,14 @@
 #include "radio.h"
 
 class Radio;
+class Remote;
+
+struct CommandListener
+{
+    std::function<void(Remote *, byte, byte)> callback;
+    // Whoever registered the listener, so it can be removed again.
+    const void *owner;
+};
 
 class Remote
 {
@@ -15,18 +23,25 @@ public:
     uint32_t getSerial();
     String getSerialString();
     const char *getName();
+    uint8_t getLastPackageId();
+    bool getLastRpd();
+    void setLastPackage(uint8_t packageId, bool rpd);
 
-    bool registerCommandListener(std::function<void(Remote *, byte, byte)> callback);
+    bool registerCommandListener(std::function<void(Remote *, byte, byte)> callback, const void *owner = nullptr);
+    void unregisterCommandListeners(const void *owner);
 
     void callback(byte command, byte options);
 
 private:
     Radio *radio;
     uint32_t serial;
-    const char *name;
+    String name;
     String serialString;
+    // The sequence number and signal strength of the package currently passed to the listeners.
+    uint8_t lastPackageId = 0;
+    bool lastRpd = false;
 
-    std::function<void(Remote *, byte, byte)> commandListeners[constants::MAX_COMMAND_LISTENERS];
+    CommandListener commandListeners[constants::MAX_COMMAND_LISTENERS];
     uint8_t numCommandListeners = 0;
 };
 
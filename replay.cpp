@@ -0,0 +1,231 @@
+#include "replay.h"
+#include "radio.h"
+#include "logger.h"
+
+Replay::Replay()
+{
+}
+
+Replay::~Replay()
+{
+}
+
+bool Replay::load(const byte *batch, size_t length)
+{
+    if (length < Capture::HEADER_LENGTH || memcmp(batch, "L2MC", 4) ||
+        batch[4] != Capture::FORMAT_VERSION || batch[5] != Capture::RECORD_LENGTH)
+    {
+        LOG_WARNING("[Replay] Ignoring batch in unknown format!");
+        return false;
+    }
+    uint16_t records = batch[6] | batch[7] << 8;
+    if (length < Capture::HEADER_LENGTH + (size_t)records * Capture::RECORD_LENGTH)
+    {
+        LOG_WARNING("[Replay] Ignoring truncated batch!");
+        return false;
+    }
+
+    if (!this->running)
+        this->start();
+    for (int i = 0; i < records; i++)
+    {
+        const byte *record = batch + Capture::HEADER_LENGTH + i * Capture::RECORD_LENGTH;
+        ReplayFrame frame;
+        memcpy(frame.raw, record + 6, Capture::RAW_LENGTH);
+        frame.result = (Capture::Result)record[4];
+        if (this->push(frame) && record[4] == Capture::Result::ACCEPTED)
+            this->stats.expectedEvents++;
+    }
+    LOG_INFO("[Replay] Loaded %u frames.", records);
+    return true;
+}
+
+bool Replay::generate(Generator generator, uint32_t serial, uint16_t count, uint8_t repeats, uint8_t sequence)
+{
+    if (generator == Generator::NONE || count == 0)
+        return false;
+
+    if (!this->running)
+        this->start();
+    this->generator = generator;
+    this->serial = serial;
+    this->remaining = count;
+    this->repeats = max(repeats, (uint8_t)1);
+    this->repeat = 0;
+    // Start before the wrap around, so it happens in the middle of the burst.
+    this->sequence = generator == Generator::WRAPAROUND ? (uint8_t)(0 - min(count / 2, 64)) : sequence;
+    if (generator == Generator::BURST || generator == Generator::WRAPAROUND)
+        this->stats.expectedEvents += count;
+    LOG_INFO("[Replay] Generating %u events.", count);
+    return true;
+}
+
+void Replay::setRate(uint16_t framesPerSecond)
+{
+    this->rate = framesPerSecond;
+}
+
+void Replay::loop()
+{
+    if (!this->running)
+        return;
+
+    // Top up the queue with generated frames.
+    while (this->remaining > 0 && this->frames.size() < constants::REPLAY_QUEUE_SIZE - 1)
+    {
+        ReplayFrame frame;
+        this->generateFrame(&frame);
+        this->push(frame);
+    }
+
+    // Done, once everything was replayed and the resulting events had time to arrive.
+    if (this->remaining > 0 || this->frames.size() > 0)
+    {
+        this->idleSince = millis();
+        return;
+    }
+    if (millis() - this->idleSince < constants::REPLAY_SETTLE_MS)
+        return;
+    this->running = false;
+    this->reportReady = true;
+    LOG_INFO("[Replay] done!");
+}
+
+void Replay::countEvent()
+{
+    this->stats.events++;
+}
+
+bool Replay::isReportReady()
+{
+    return this->reportReady;
+}
+
+void Replay::clearReport()
+{
+    this->reportReady = false;
+}
+
+const ReplayStats *Replay::getStats()
+{
+    return &this->stats;
+}
+
+bool Replay::poll(ReplayFrame *frame)
+{
+    unsigned long now = micros();
+    if (this->rate > 0 && this->stats.frames > 0 && (long)(now - this->nextFrame) < 0)
+        return false;
+    if (!this->frames.pop(*frame))
+        return false;
+
+    // The frame was pushed after the run was started, so a new run is always noticed before its first frame is
+    // counted.
+    uint32_t run = this->run.load(std::memory_order_acquire);
+    if (run != this->radioRun)
+    {
+        this->radioRun = run;
+        this->stats.frames = 0;
+        memset(this->stats.results, 0, sizeof(this->stats.results));
+        this->stats.firstFrame = 0;
+        this->stats.lastFrame = 0;
+        this->numSequences = 0;
+    }
+
+    if (this->stats.frames == 0)
+    {
+        this->stats.firstFrame = now;
+        this->nextFrame = now;
+    }
+    this->stats.frames++;
+    this->stats.lastFrame = now;
+    if (this->rate > 0)
+    {
+        this->nextFrame += 1000000UL / this->rate;
+        // Don't try to catch up after a long stall of the loop.
+        if ((long)(now - this->nextFrame) > 100000L)
+            this->nextFrame = now;
+    }
+    return true;
+}
+
+uint8_t *Replay::getPackageId(const ReplayFrame *frame, uint32_t serial, uint8_t package_id)
+{
+    for (int i = 0; i < this->numSequences; i++)
+    {
+        if (this->sequences[i].serial == serial)
+            return &this->sequences[i].package_id;
+    }
+
+    // The first frame of a serial decides whether it is known. Start right behind it if it was accepted back then,
+    // so it gets the same result again.
+    if (frame->result != Capture::Result::ACCEPTED && frame->result != Capture::Result::DUPLICATE)
+        return nullptr;
+    if (this->numSequences >= constants::REPLAY_MAX_SERIALS)
+    {
+        LOG_WARNING("[Replay] Too many serials, treating 0x%06X as unknown!", serial);
+        return nullptr;
+    }
+    ReplaySequence *sequence = &this->sequences[this->numSequences++];
+    sequence->serial = serial;
+    sequence->package_id = frame->result == Capture::Result::ACCEPTED ? package_id - 1 : package_id;
+    return &sequence->package_id;
+}
+
+void Replay::countResult(Capture::Result result)
+{
+    this->stats.results[result]++;
+}
+
+void Replay::start()
+{
+    // Only the counters of this side, the radio side resets its own ones.
+    this->stats.queued = 0;
+    this->stats.dropped = 0;
+    this->stats.expectedEvents = 0;
+    this->stats.events = 0;
+    this->run.fetch_add(1, std::memory_order_release);
+    this->running = true;
+    this->reportReady = false;
+    this->idleSince = millis();
+}
+
+bool Replay::push(const ReplayFrame &frame)
+{
+    if (!this->frames.push(frame))
+    {
+        this->stats.dropped++;
+        return false;
+    }
+    this->stats.queued++;
+    return true;
+}
+
+void Replay::generateFrame(ReplayFrame *frame)
+{
+    frame->result = Capture::Result::ACCEPTED;
+    if (this->generator == Generator::NOISE)
+    {
+        for (int i = 0; i < Capture::RAW_LENGTH; i++)
+        {
+            frame->raw[i] = random(256);
+        }
+        this->remaining--;
+        return;
+    }
+
+    byte data[Capture::DECODED_LENGTH];
+    Radio::buildPackage(this->serial, this->sequence, 0x04, 0x01, data);
+    if (this->generator == Generator::BAD_CRC)
+        data[16] ^= 1 << random(8);
+    Radio::encodePackage(data, frame->raw);
+
+    // Every event is sent multiple times with the same sequence number.
+    this->repeat++;
+    if (this->generator == Generator::BAD_CRC || this->repeat >= this->repeats)
+    {
+        this->repeat = 0;
+        this->sequence++;
+        this->remaining--;
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "constants.h"
+#include "capture.h"
+#include "spsc_queue.h"
+
+#include <atomic>
+
+struct ReplayFrame
+{
+    byte raw[Capture::RAW_LENGTH];
+    // The result the frame got when it was recorded. Generated frames count as accepted.
+    Capture::Result result;
+};
+
+// The last sequence number of a serial, as seen by the replay.
+struct ReplaySequence
+{
+    uint32_t serial;
+    uint8_t package_id;
+};
+
+struct ReplayStats
+{
+    // Written by the radio side, which also resets them once it sees the first frame of a new run.
+    uint32_t frames;
+    uint32_t results[Capture::NUM_RESULTS];
+    unsigned long firstFrame;
+    unsigned long lastFrame;
+
+    // Written by the controller side.
+    uint32_t queued;
+    uint32_t dropped;
+    uint32_t expectedEvents;
+    uint32_t events;
+};
+
+/*
+ * Feeds recorded or generated frames into the radio's receive path, as if they were received by the nRF24.
+ * Recordings use the batch format of Capture, the expected events are taken from the results recorded back
+ * then. Generated frames are produced in small portions, so any number of them fits into the frame queue.
+ * Events resulting from replayed frames are only counted, not passed on to the remotes.
+ * Replayed frames are deduplicated by their own sequence numbers, so they never get in the way of the real remotes.
+ */
+class Replay
+{
+public:
+    enum Generator
+    {
+        NONE,
+        // Random bytes, mostly rejected because of the preamble.
+        NOISE,
+        // Valid packages with a broken checksum.
+        BAD_CRC,
+        // Valid packages, each one repeated like a real remote does.
+        BURST,
+        // Like BURST, but the sequence number wraps around in the middle.
+        WRAPAROUND
+    };
+
+    Replay();
+    ~Replay();
+
+    // Controller side
+    bool load(const byte *batch, size_t length);
+    bool generate(Generator generator, uint32_t serial, uint16_t count, uint8_t repeats, uint8_t sequence);
+    void setRate(uint16_t framesPerSecond);
+    void loop();
+    void countEvent();
+    bool isReportReady();
+    void clearReport();
+    const ReplayStats *getStats();
+
+    // Radio side
+    bool poll(ReplayFrame *frame);
+    uint8_t *getPackageId(const ReplayFrame *frame, uint32_t serial, uint8_t package_id);
+    void countResult(Capture::Result result);
+
+private:
+    SpscQueue<ReplayFrame, constants::REPLAY_QUEUE_SIZE> frames;
+    ReplayStats stats = {};
+    // Counts the runs. Only written by the controller side, the radio side resets its counters when it changes.
+    std::atomic<uint32_t> run{0};
+    uint32_t radioRun = 0;
+    ReplaySequence sequences[constants::REPLAY_MAX_SERIALS];
+    uint8_t numSequences = 0;
+    // Frames per second, 0 replays as fast as possible.
+    uint16_t rate = 0;
+    unsigned long nextFrame = 0;
+
+    bool running = false;
+    bool reportReady = false;
+    unsigned long idleSince = 0;
+
+    Generator generator = Generator::NONE;
+    uint32_t serial = 0;
+    uint16_t remaining = 0;
+    uint8_t repeats = 1;
+    uint8_t repeat = 0;
+    uint8_t sequence = 0;
+
+    void start();
+    bool push(const ReplayFrame &frame);
+    void generateFrame(ReplayFrame *frame);
+};
+
+#endif
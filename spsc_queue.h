@@ -0,0 +1,53 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+
+/*
+ * Fixed-size queue for exactly one producer and one consumer, which may run concurrently without any locks.
+ * Each side only writes its own index and reads the other one. One slot always stays empty, to tell a full
+ * queue from an empty one, so SIZE - 1 items fit.
+ */
+template <typename T, size_t SIZE>
+class SpscQueue
+{
+    static_assert(SIZE >= 2 && (SIZE & (SIZE - 1)) == 0, "SIZE must be a power of two");
+
+public:
+    // Only called by the producer.
+    bool push(const T &item)
+    {
+        size_t tail = this->tail.load(std::memory_order_relaxed);
+        size_t next = (tail + 1) & (SIZE - 1);
+        if (next == this->head.load(std::memory_order_acquire))
+            return false;
+        this->items[tail] = item;
+        this->tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // Only called by the consumer.
+    bool pop(T &item)
+    {
+        size_t head = this->head.load(std::memory_order_relaxed);
+        if (head == this->tail.load(std::memory_order_acquire))
+            return false;
+        item = this->items[head];
+        this->head.store((head + 1) & (SIZE - 1), std::memory_order_release);
+        return true;
+    }
+
+    // Only a snapshot, if the other side is running at the same time.
+    size_t size()
+    {
+        return (this->tail.load(std::memory_order_acquire) - this->head.load(std::memory_order_acquire)) & (SIZE - 1);
+    }
+
+private:
+    T items[SIZE];
+    std::atomic<size_t> head{0};
+    std::atomic<size_t> tail{0};
+};
+
+#endif
@@ -0,0 +1,235 @@
+/*
+ * Host test for cluster.cpp. Not part of the sketch, build and run it on a PC:
+ *
+ *     g++ -std=c++17 -O2 -Itest/host test/cluster_test.cpp -o cluster_test && ./cluster_test
+ *
+ * Several Cluster instances play the controllers of one room. Their claims pass through a simulated broker with a
+ * fixed latency, including the round trip through the claim format. For each scenario the test checks that no two
+ * controllers publish the same event, and that every claimed event is published by one of them.
+ */
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Only the claim logic is tested, the remotes and the logger of the sketch are left out.
+#define REMOTE_H
+#define LOGGER_H
+#define LOG_ERROR(...)
+#define LOG_WARNING(...)
+#define LOG_INFO(...)
+#define LOG_DEBUG(...)
+class Remote;
+
+#include "../cluster.cpp"
+
+static const unsigned long LATENCY_MS = 20;
+static Remote *const REMOTE = reinterpret_cast<Remote *>(0x1000);
+
+struct Heard
+{
+    uint8_t controller;
+    unsigned long at;
+    ClusterClaim claim;
+};
+
+struct Message
+{
+    uint8_t from;
+    unsigned long at;
+    ClusterClaim claim;
+};
+
+struct Published
+{
+    uint8_t controller;
+    ClusterClaim claim;
+};
+
+static int failures = 0;
+
+static void check(bool condition, const char *scenario, const char *what)
+{
+    if (condition)
+        return;
+    printf("%s: %s\n", scenario, what);
+    failures++;
+}
+
+static ClusterClaim action(uint8_t sequence, bool rpd, uint8_t rank = 0)
+{
+    return {0x123456, sequence, rpd, rank, sequence, false};
+}
+
+static ClusterClaim gesture(uint8_t first, uint8_t last, bool rpd, uint8_t rank = 0)
+{
+    return {0x123456, first, rpd, rank, last, true};
+}
+
+// Runs the controllers until every claim window is over and returns the events they published.
+static std::vector<Published> run(uint8_t numControllers, const std::vector<Heard> &heard)
+{
+    std::vector<Cluster *> clusters;
+    for (int i = 0; i < numControllers; i++)
+    {
+        clusters.push_back(new Cluster(0));
+        clusters[i]->setClientId(String(("controller-" + std::to_string(i)).c_str()));
+    }
+
+    std::vector<Message> messages;
+    std::vector<Published> published;
+    for (unsigned long now = 0; now < 1000; now++)
+    {
+        setMillis(now);
+        for (const Message &message : messages)
+        {
+            if (message.at != now)
+                continue;
+            // Every claim takes the way through the broker, including the own one.
+            String payload = Cluster::formatClaim(message.claim);
+            ClusterClaim parsed;
+            if (!Cluster::parseClaim(payload.c_str(), &parsed))
+                continue;
+            std::string clientId = "controller-" + std::to_string(message.from);
+            for (Cluster *cluster : clusters)
+            {
+                cluster->handleClaim(clientId.c_str(), parsed);
+            }
+        }
+
+        for (const Heard &event : heard)
+        {
+            if (event.at != now)
+                continue;
+            ClusterClaim claim = event.claim;
+            ClusterEvent clusterEvent = {REMOTE, claim.gesture, {}, 0, 0};
+            // The event carries its claim, so the test knows what was published.
+            clusterEvent.gesture.sequence = claim.sequence;
+            clusterEvent.gesture.lastSequence = claim.lastSequence;
+            clusterEvent.command = claim.rpd;
+            clusterEvent.options = claim.rank;
+            switch (clusters[event.controller]->claim(claim, clusterEvent))
+            {
+            case Cluster::ClaimResult::PENDING:
+                messages.push_back({event.controller, now + LATENCY_MS, claim});
+                break;
+
+            case Cluster::ClaimResult::UNCLAIMED:
+                published.push_back({event.controller, claim});
+                break;
+
+            default:
+                break;
+            }
+        }
+
+        for (int i = 0; i < numControllers; i++)
+        {
+            ClusterEvent won;
+            while (clusters[i]->popWon(&won))
+            {
+                ClusterClaim claim = {0x123456, won.gesture.sequence, won.command != 0, won.options, won.gesture.lastSequence, won.isGesture};
+                published.push_back({(uint8_t)i, claim});
+            }
+        }
+    }
+
+    for (Cluster *cluster : clusters)
+    {
+        delete cluster;
+    }
+    return published;
+}
+
+static bool overlaps(const ClusterClaim &claim, const ClusterClaim &other)
+{
+    if (claim.gesture != other.gesture)
+        return false;
+    uint8_t length = claim.lastSequence - claim.sequence;
+    uint8_t otherLength = other.lastSequence - other.sequence;
+    return (uint8_t)(other.sequence - claim.sequence) <= length || (uint8_t)(claim.sequence - other.sequence) <= otherLength;
+}
+
+static void scenario(const char *name, uint8_t numControllers, const std::vector<Heard> &heard)
+{
+    std::vector<Published> published = run(numControllers, heard);
+
+    for (size_t i = 0; i < published.size(); i++)
+    {
+        for (size_t j = i + 1; j < published.size(); j++)
+        {
+            if (published[i].controller != published[j].controller)
+                check(!overlaps(published[i].claim, published[j].claim), name, "an event was published by two controllers");
+        }
+    }
+    for (const Heard &event : heard)
+    {
+        bool covered = false;
+        for (const Published &publication : published)
+        {
+            covered = covered || overlaps(event.claim, publication.claim);
+        }
+        check(covered, name, "an event was not published at all");
+    }
+    printf("%-40s %zu published\n", name, published.size());
+}
+
+static void testWithdraw()
+{
+    setMillis(0);
+    Cluster cluster(0);
+    cluster.setClientId("controller-0");
+    ClusterEvent event = {REMOTE, false, {}, 0, 0};
+    check(cluster.claim(action(1, true), event) == Cluster::ClaimResult::PENDING, "withdraw", "claim not pending");
+    cluster.withdraw();
+    setMillis(1000);
+    ClusterEvent won;
+    check(!cluster.popWon(&won), "withdraw", "a withdrawn claim was won");
+    check(cluster.getStats()->claimed == 0 && cluster.getStats()->overflows == 1, "withdraw", "wrong statistics");
+}
+
+static void testParse()
+{
+    ClusterClaim claim;
+    check(Cluster::parseClaim("123456,7,1,0", &claim) && claim.lastSequence == 7 && !claim.gesture, "parse", "old format");
+    check(Cluster::parseClaim(Cluster::formatClaim(gesture(250, 4, true, 2)).c_str(), &claim) &&
+              claim.sequence == 250 && claim.lastSequence == 4 && claim.rank == 2 && claim.gesture,
+          "parse", "round trip");
+    check(!Cluster::parseClaim("123456,300,1,0", &claim), "parse", "sequence out of range");
+    check(!Cluster::parseClaim("garbage", &claim), "parse", "garbage");
+}
+
+int main()
+{
+    scenario("action, three controllers", 3,
+             {{0, 0, action(5, false)}, {1, 2, action(5, true)}, {2, 3, action(5, true)}});
+    scenario("action, heard late", 2,
+             {{0, 0, action(5, true)}, {1, 100, action(5, false)}});
+    scenario("action, lower rank wins", 2,
+             {{0, 0, action(5, true, 1)}, {1, 0, action(5, false, 0)}});
+    scenario("gesture, first turn missed", 2,
+             {{0, 0, gesture(10, 14, false)}, {1, 1, gesture(11, 14, true)}});
+    scenario("gesture, first turn missed, other wins", 2,
+             {{0, 0, gesture(10, 14, true)}, {1, 1, gesture(11, 14, false)}});
+    scenario("gesture, split differently", 2,
+             {{0, 0, gesture(10, 20, true)}, {1, 2, gesture(11, 22, false)},
+              {0, 300, gesture(21, 30, true)}, {1, 305, gesture(23, 30, false)}});
+    scenario("gesture, split differently, other wins", 2,
+             {{0, 0, gesture(10, 20, false)}, {1, 2, gesture(11, 22, true)},
+              {0, 300, gesture(21, 30, false)}, {1, 305, gesture(23, 30, true)}});
+    scenario("gesture, wrap around", 2,
+             {{0, 0, gesture(250, 4, false)}, {1, 1, gesture(252, 5, true)}});
+    scenario("action during gesture", 2,
+             {{0, 0, gesture(10, 14, true)}, {1, 1, gesture(10, 14, false)},
+              {0, 2, action(12, false)}, {1, 3, action(12, true)}});
+
+    testWithdraw();
+    testParse();
+
+    if (failures > 0)
+    {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * The parts of the Arduino core the host tests need. Time only moves when a test calls setMillis().
+ */
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+
+typedef uint8_t byte;
+
+#define HEX 16
+#define DEC 10
+
+class String
+{
+public:
+    String() {}
+    String(const char *value) : value(value != nullptr ? value : "") {}
+    String(const std::string &value) : value(value) {}
+    String(unsigned long number, unsigned char base = DEC) : value(format(number, base)) {}
+    String(unsigned int number, unsigned char base = DEC) : value(format(number, base)) {}
+    String(int number, unsigned char base = DEC) : value(base == DEC ? std::to_string(number) : format(number, base)) {}
+
+    const char *c_str() const { return this->value.c_str(); }
+    unsigned int length() const { return this->value.size(); }
+    String operator+(const String &other) const { return String(this->value + other.value); }
+    String operator+(const char *other) const { return String(this->value + other); }
+    friend String operator+(const char *value, const String &other) { return String(value + other.value); }
+
+private:
+    std::string value;
+
+    static std::string format(unsigned long number, unsigned char base)
+    {
+        char buffer[24];
+        snprintf(buffer, sizeof(buffer), base == HEX ? "%lx" : "%lu", number);
+        return buffer;
+    }
+};
+
+inline unsigned long hostMillis = 0;
+
+inline unsigned long millis()
+{
+    return hostMillis;
+}
+
+inline void setMillis(unsigned long now)
+{
+    hostMillis = now;
+}
+
+#endif
@@ -0,0 +1,75 @@
+/*
+ * Host test for spsc_queue.h. Not part of the sketch, build and run it on a PC:
+ *
+ *     g++ -std=c++17 -O2 -pthread test/spsc_queue_test.cpp -o spsc_queue_test && ./spsc_queue_test
+ *
+ * A producer and a consumer thread pass numbered items through queues of different sizes. The consumer checks that
+ * every item arrives exactly once and in order. For each size, the throughput and how often either side found the
+ * queue full or empty (the contention) are printed.
+ */
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+
+#include "../spsc_queue.h"
+
+static const uint32_t NUM_ITEMS = 2000000;
+
+struct Item
+{
+    uint32_t sequence;
+    uint32_t check;
+};
+
+template <size_t SIZE>
+static bool run()
+{
+    static SpscQueue<Item, SIZE> queue;
+    uint64_t full = 0;
+    uint64_t empty = 0;
+    uint32_t errors = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread producer([&]()
+                         {
+        for (uint32_t i = 0; i < NUM_ITEMS; i++)
+        {
+            Item item = {i, ~i};
+            while (!queue.push(item))
+            {
+                full++;
+                std::this_thread::yield();
+            }
+        } });
+    std::thread consumer([&]()
+                         {
+        for (uint32_t expected = 0; expected < NUM_ITEMS; expected++)
+        {
+            Item item;
+            while (!queue.pop(item))
+            {
+                empty++;
+                std::this_thread::yield();
+            }
+            if (item.sequence != expected || item.check != ~expected)
+                errors++;
+        } });
+    producer.join();
+    consumer.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    bool ok = errors == 0 && queue.size() == 0;
+    printf("size %4zu: %s, %.1f M items/s, %llu full, %llu empty, %u errors\n", SIZE, ok ? "ok" : "FAILED",
+           NUM_ITEMS / seconds / 1e6, (unsigned long long)full, (unsigned long long)empty, errors);
+    return ok;
+}
+
+int main()
+{
+    bool ok = run<2>();
+    ok &= run<16>();
+    ok &= run<64>();
+    ok &= run<1024>();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,139 @@
+#include "transition.h"
+#include "logger.h"
+
+Transitions::Transitions()
+{
+}
+
+Transitions::~Transitions()
+{
+}
+
+bool Transitions::start(Lightbar *lightbar, int8_t brightness, int8_t temperature, unsigned long duration)
+{
+    // A new transition always replaces the running one.
+    this->cancel(lightbar);
+
+    // Steps only end at the right value if the one they start from is known. Otherwise set the value right away.
+    if (brightness >= 0 && !lightbar->isBrightnessKnown())
+    {
+        lightbar->setBrightness(brightness);
+        brightness = -1;
+    }
+    if (temperature >= 0 && !lightbar->isTemperatureKnown())
+    {
+        lightbar->setTemperature(temperature);
+        temperature = -1;
+    }
+
+    const LightbarState *state = lightbar->getState();
+    uint16_t steps = 0;
+    if (brightness >= 0)
+        steps += abs(brightness - state->brightness);
+    if (temperature >= 0)
+        steps += abs(temperature - state->temperature);
+    if (steps == 0)
+        return true;
+
+    if (this->numTransitions >= constants::MAX_LIGHTBARS)
+        return false;
+
+    Transition *transition = &this->transitions[this->numTransitions];
+    transition->lightbar = lightbar;
+    transition->brightness = brightness;
+    transition->temperature = temperature;
+    transition->interval = max(duration / steps, constants::TRANSITION_MIN_STEP_INTERVAL_MS);
+    transition->next = millis();
+    transition->expected = *state;
+    this->numTransitions++;
+
+    LOG_DEBUG("[Transitions] Starting transition of %u steps for light bar %s", steps, lightbar->getSerialString().c_str());
+    return true;
+}
+
+void Transitions::cancel(Lightbar *lightbar)
+{
+    for (int i = 0; i < this->numTransitions; i++)
+    {
+        if (this->transitions[i].lightbar == lightbar)
+        {
+            this->remove(i);
+            return;
+        }
+    }
+}
+
+void Transitions::loop()
+{
+    // Only do a single step per loop, so the send queue is not flooded. Start looking at the transition
+    // after the last one that did a step, so all light bars advance at the same pace.
+    unsigned long now = millis();
+    for (int i = 0; i < this->numTransitions; i++)
+    {
+        uint8_t index = (this->nextTransition + i) % this->numTransitions;
+        Transition *transition = &this->transitions[index];
+        // Each step waits until the previous one was sent, so steps never pile up in the send queue when the radio
+        // is slower than the transition.
+        if ((long)(now - transition->next) < 0 || transition->lightbar->hasPendingCommands())
+            continue;
+
+        if (!this->step(transition))
+            this->remove(index);
+        else
+            this->nextTransition = index + 1;
+        return;
+    }
+}
+
+bool Transitions::step(Transition *transition)
+{
+    Lightbar *lightbar = transition->lightbar;
+    const LightbarState *state = lightbar->getState();
+    if (memcmp(state, &transition->expected, sizeof(LightbarState)))
+    {
+        LOG_DEBUG("[Transitions] Light bar %s was changed, cancelling transition.", lightbar->getSerialString().c_str());
+        return false;
+    }
+
+    int8_t brightness = transition->brightness >= 0 ? transition->brightness - state->brightness : 0;
+    int8_t temperature = transition->temperature >= 0 ? transition->temperature - state->temperature : 0;
+    if (brightness == 0 && temperature == 0)
+        return false;
+
+    // Move the value with the most steps left, so both arrive at the same time. Steps are sent with the lowest
+    // priority, so they never delay commands the user is waiting for.
+    Lightbar::Command command;
+    int8_t left;
+    if (abs(brightness) >= abs(temperature))
+    {
+        command = brightness > 0 ? Lightbar::Command::BRIGHTER : Lightbar::Command::DIMMER;
+        left = brightness;
+    }
+    else
+    {
+        command = temperature > 0 ? Lightbar::Command::WARMER : Lightbar::Command::COOLER;
+        left = temperature;
+    }
+
+    // If the radio could not keep up, catch up with several steps in one command, so the transition still ends in
+    // time.
+    unsigned long now = millis();
+    int8_t steps = min((unsigned long)abs(left), (now - transition->next) / transition->interval + 1);
+    byte options = steps == 1 ? 0x0 : (byte)(left > 0 ? steps : -steps);
+    lightbar->sendRawCommand(command, options, Radio::Priority::BULK);
+    transition->expected = *lightbar->getState();
+
+    transition->next += steps * transition->interval;
+    if ((long)(now - transition->next) > (long)transition->interval)
+        transition->next = now;
+    return true;
+}
+
+void Transitions::remove(uint8_t index)
+{
+    for (int i = index; i < this->numTransitions - 1; i++)
+    {
+        this->transitions[i] = this->transitions[i + 1];
+    }
+    this->numTransitions--;
+}
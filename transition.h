@@ -0,0 +1,39 @@
+#ifndef TRANSITION_H
+#define TRANSITION_H
+
+#include "constants.h"
+#include "lightbar.h"
+
+class Lightbar;
+
+struct Transition
+{
+    Lightbar *lightbar;
+    // The target steps, -1 if the value should not change.
+    int8_t brightness;
+    int8_t temperature;
+    unsigned long interval;
+    unsigned long next;
+    // The state after the last step. If the light bar's state differs, it was changed by someone else.
+    LightbarState expected;
+};
+
+class Transitions
+{
+public:
+    Transitions();
+    ~Transitions();
+    bool start(Lightbar *lightbar, int8_t brightness, int8_t temperature, unsigned long duration);
+    void cancel(Lightbar *lightbar);
+    void loop();
+
+private:
+    Transition transitions[constants::MAX_LIGHTBARS];
+    uint8_t numTransitions = 0;
+    uint8_t nextTransition = 0;
+
+    bool step(Transition *transition);
+    void remove(uint8_t index);
+};
+
+#endif